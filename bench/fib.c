@@ -0,0 +1,13 @@
+#include <stdio.h>
+
+// call-heavy: about five instructions per call and return
+
+int fib(int n) {
+    if (n < 2) return n;
+    return fib(n - 1) + fib(n - 2);
+}
+
+int main(int argc, char **argv) {
+    printf("fib(27) = %d\n", fib(27));
+    return 0;
+}
@@ -0,0 +1,34 @@
+#include <stdio.h>
+
+// writes a c4 program with the given number of functions (default 1000) for compile-speed runs
+
+int main(int argc, char **argv) {
+    int n, i;
+    char *s;
+
+    n = 0;
+    if (argc > 1) { s = argv[1]; while (*s >= '0' && *s <= '9') n = n * 10 + *s++ - '0'; }
+    if (n < 1) n = 1000;
+    printf("#include <stdio.h>\n\n");
+    i = 0;
+    while (i < n) {
+        printf("int g%d;\n\n", i);
+        printf("int f%d(int a, int b) {\n", i);
+        printf("    int c, d;\n");
+        printf("    c = a * %d + b; d = 0;\n", i % 5 + 1);
+        printf("    while (c > %d) { c = c - 7; ++d; }\n", i + 100);
+        printf("    if (c == %d) g%d = c; else g%d = a - b;\n", i, i, i);
+        printf("    return c + d * 2 - (a > b ? a : b);\n");
+        printf("}\n\n");
+        ++i;
+    }
+    printf("int main(int argc, char **argv) {\n");
+    printf("    int s;\n");
+    printf("    s = 0;\n");
+    i = 0;
+    while (i < n) { printf("    s = s + f%d(%d, %d);\n", i, i % 13, i % 7); ++i; }
+    printf("    printf(\"sum %%d\\n\", s);\n");
+    printf("    return 0;\n");
+    printf("}\n");
+    return 0;
+}
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+// arithmetic-heavy: a fixed point n-body simulation over int arrays
+
+int n, *x, *y, *z, *vx, *vy, *vz, *m;
+
+int isqrt(int v) {
+    int r, s;
+    if (v < 2) return v;
+    r = v;
+    s = (r + 1) / 2;
+    while (s < r) { r = s; s = (r + v / r) / 2; }
+    return r;
+}
+
+int wrap(int v) { // keep the bodies in a periodic box so int math never overflows
+    while (v > 2000) v = v - 4000;
+    while (v < -2000) v = v + 4000;
+    return v;
+}
+
+int *ints(int k) {
+    int *p;
+    // bytes per int, without sizeof
+    if (!(p = malloc(k * ((char *)((int *)0 + 1) - (char *)0)))) { printf("failed to malloc memory\n"); exit(1); }
+    return p;
+}
+
+int step() {
+    int i, j, dx, dy, dz, d2, d, f;
+    i = 0;
+    while (i < n) {
+        j = i + 1;
+        while (j < n) {
+            dx = x[j] - x[i]; dy = y[j] - y[i]; dz = z[j] - z[i];
+            d2 = dx * dx + dy * dy + dz * dz + 100;
+            d = isqrt(d2);
+            f = d2 / 1024 * d / 1024 + 1;
+            vx[i] = vx[i] + dx * m[j] / f; vy[i] = vy[i] + dy * m[j] / f; vz[i] = vz[i] + dz * m[j] / f;
+            vx[j] = vx[j] - dx * m[i] / f; vy[j] = vy[j] - dy * m[i] / f; vz[j] = vz[j] - dz * m[i] / f;
+            ++j;
+        }
+        ++i;
+    }
+    i = 0;
+    while (i < n) {
+        vx[i] = vx[i] - vx[i] / 64; vy[i] = vy[i] - vy[i] / 64; vz[i] = vz[i] - vz[i] / 64;
+        x[i] = wrap(x[i] + vx[i] / 16); y[i] = wrap(y[i] + vy[i] / 16); z[i] = wrap(z[i] + vz[i] / 16);
+        ++i;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int i, seed, steps, sum;
+
+    n = 16;
+    x = ints(n); y = ints(n); z = ints(n); vx = ints(n); vy = ints(n); vz = ints(n); m = ints(n);
+    seed = 1;
+    i = 0;
+    while (i < n) {
+        seed = (seed * 75 + 74) % 65537; x[i] = seed % 2000 - 1000;
+        seed = (seed * 75 + 74) % 65537; y[i] = seed % 2000 - 1000;
+        seed = (seed * 75 + 74) % 65537; z[i] = seed % 2000 - 1000;
+        vx[i] = vy[i] = vz[i] = 0;
+        m[i] = 1 + seed % 8;
+        ++i;
+    }
+    steps = 0;
+    while (steps < 2000) { step(); ++steps; }
+    sum = 0;
+    i = 0;
+    while (i < n) { sum = (sum * 31 + x[i] + y[i] + z[i]) % 1000003; ++i; }
+    printf("checksum %d\n", sum);
+    return 0;
+}
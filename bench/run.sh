@@ -0,0 +1,78 @@
+#!/bin/sh
+# bench/run.sh - time the benchmarks under c4 and c4x86 and compare them with a stored baseline
+#
+# usage: bench/run.sh [-u]      (from the top of the tree)
+#
+#   C4=./c4 C4X86=./c4x86       binaries to time; c4x86 is skipped when it is not built
+#   BASELINE=bench/baseline.txt results to compare with; written on the first run or with -u
+#   GEN=20000                   functions in the generated compile-speed source
+#   REPEAT=3                    runs per measurement; the fastest one counts
+#
+# c4 is timed with and without a bytecode cache (-c): the plain run compiles and executes,
+# the cached one only executes, so compile = plain - cached and exec = cached.
+# c4x86 cannot skip its compile, so only its total is reported.
+
+C4=${C4:-./c4}
+C4X86=${C4X86:-./c4x86}
+BASELINE=${BASELINE:-bench/baseline.txt}
+GEN=${GEN:-20000}
+REPEAT=${REPEAT:-3}
+update=0
+[ "$1" = "-u" ] && update=1
+
+[ -x "$C4" ] || { echo "no $C4: build it with gcc -O2 -o c4 c4.c" >&2; exit 1; }
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+
+ms() { echo $(( $(date +%s%N) / 1000000 )); }
+
+# best() cmd...: fastest of $REPEAT runs of cmd in milliseconds, its output left in $tmp/out
+best() {
+  b= n=0
+  while [ $n -lt "$REPEAT" ]; do
+    t0=$(ms); "$@" > "$tmp/out"; t=$(( $(ms) - t0 ))
+    [ -z "$b" ] || [ $t -lt $b ] && b=$t
+    n=$((n + 1))
+  done
+  echo $b
+}
+
+# the generated program: c4 prints its exit line after the source, so drop it
+"$C4" bench/gen.c "$GEN" | sed '$d' > "$tmp/gen.c"
+
+# name and command line of each benchmark
+set -- fib "bench/fib.c" \
+       sieve "bench/sieve.c" \
+       nbody "bench/nbody.c" \
+       strhash "bench/strhash.c" \
+       selfhost "c4.c c4.c hello.c" \
+       compile "$tmp/gen.c"
+
+printf '%-10s %12s %10s %10s %10s %10s\n' bench cycles compile_ms exec_ms Mcycles/s c4x86_ms > "$tmp/result"
+while [ $# -gt 1 ]; do
+  name=$1 args=$2; shift 2
+  total=$(best "$C4" $args); cp "$tmp/out" "$tmp/out1"
+  rm -f "$tmp/cache"; "$C4" -c "$tmp/cache" $args > /dev/null
+  exec=$(best "$C4" -c "$tmp/cache" $args)
+  cmp -s "$tmp/out1" "$tmp/out" || echo "$name: cached run differs" >&2
+  cycles=$(sed -n 's/^exit(.*) cycle = //p' "$tmp/out" | tail -1)
+  compile=$((total - exec)); [ $compile -lt 0 ] && compile=0
+  x86=-
+  [ -x "$C4X86" ] && x86=$(best "$C4X86" $args)
+  printf '%-10s %12s %10s %10s %10s %10s\n' "$name" "$cycles" "$compile" "$exec" \
+    $(( cycles / (exec > 0 ? exec : 1) / 1000 )) "$x86" >> "$tmp/result"
+done
+cat "$tmp/result"
+
+if [ $update = 1 ] || [ ! -f "$BASELINE" ]; then
+  cp "$tmp/result" "$BASELINE"; echo "baseline written to $BASELINE"; exit 0
+fi
+
+# cycle counts are exact; times are compared as a percentage of the baseline, when it is large enough to mean anything
+echo; echo "against $BASELINE:"
+awk 'function pct(new, old) { return (old >= 10 && new != "-") ? sprintf("%+.0f%%", 100 * (new - old) / old) : "-" }
+     NR == FNR { if (FNR > 1) { c[$1] = $2; comp[$1] = $3; ex[$1] = $4; x[$1] = $6 }; next }
+     FNR == 1 { printf "%-10s %12s %10s %10s %10s\n", "bench", "cycles", "compile", "exec", "c4x86"; next }
+     !($1 in c) { print $1 ": not in baseline"; next }
+     { printf "%-10s %12s %10s %10s %10s\n", $1, ($2 == c[$1]) ? "same" : sprintf("%+d", $2 - c[$1]),
+              pct($3, comp[$1]), pct($4, ex[$1]), pct($6, x[$1]) }' "$BASELINE" "$tmp/result"
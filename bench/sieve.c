@@ -0,0 +1,30 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// loop-heavy: char loads and stores through a pointer
+
+int main(int argc, char **argv) {
+    char *flags;
+    int n, i, j, count, pass;
+
+    n = 1000000;
+    if (!(flags = malloc(n + 1))) { printf("failed to malloc memory\n"); return 1; }
+    pass = 0;
+    while (pass < 3) {
+        memset(flags, 1, n + 1);
+        count = 0;
+        i = 2;
+        while (i <= n) {
+            if (flags[i]) {
+                ++count;
+                j = i + i;
+                while (j <= n) { flags[j] = 0; j = j + i; }
+            }
+            ++i;
+        }
+        ++pass;
+    }
+    printf("%d primes up to %d\n", count, n);
+    return 0;
+}
@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// hashing and memcmp: insert pseudo-random words into an open addressing table, then look them up
+
+int wsz, seed;
+
+int rnd() { seed = (seed * 75 + 74) % 65537; return seed; }
+
+int hash(char *s, int len) {
+    int h;
+    h = 0;
+    while (len--) h = (h * 147 + *s++) & 1048575;
+    return h;
+}
+
+int main(int argc, char **argv) {
+    char *pool, *pp, *w;
+    int *tab, *lens, mask, nwords, i, k, len, h, found, dups, pass;
+
+    wsz = (char *)((int *)0 + 1) - (char *)0;
+    nwords = 20000;
+    mask = 65535;
+    if (!(pool = malloc(nwords * 9)) || !(tab = malloc((mask + 1) * wsz)) || !(lens = malloc((mask + 1) * wsz))) {
+        printf("failed to malloc memory\n"); return 1;
+    }
+    memset(tab, 0, (mask + 1) * wsz);
+    seed = 7; dups = 0; pp = pool;
+    i = 0;
+    while (i < nwords) {
+        len = 3 + rnd() % 6; w = pp;
+        k = 0; while (k < len) { *pp++ = 'a' + rnd() % 26; ++k; }
+        h = hash(w, len) & mask;
+        while (tab[h] && (lens[h] != len || memcmp((char *)tab[h], w, len))) h = (h + 1) & mask;
+        if (tab[h]) ++dups; else { tab[h] = (int)w; lens[h] = len; }
+        ++i;
+    }
+    found = 0;
+    pass = 0;
+    while (pass < 5) {
+        pp = pool; seed = 7;
+        i = 0;
+        while (i < nwords) {
+            len = 3 + rnd() % 6; w = pp;
+            k = 0; while (k < len) { rnd(); ++k; }
+            pp = pp + len;
+            h = hash(w, len) & mask;
+            while (tab[h] && (lens[h] != len || memcmp((char *)tab[h], w, len))) h = (h + 1) & mask;
+            if (tab[h]) ++found;
+            ++i;
+        }
+        ++pass;
+    }
+    printf("%d words, %d duplicates, %d found\n", nwords, dups, found);
+    return 0;
+}
@@ -1,40 +1,72 @@
 // c4.c - C in four functions
 
 // char, int, and pointer types
-// if, while, return, and expression statements
+// if, while, switch, return, and expression statements
 // just enough features to allow self-compilation and a bit more
 
 // Written by Robert Swierczek
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <memory.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 
+#define int intptr_t // a cell holds a pointer: the word size is the host's, 4 bytes with gcc -m32 and 8 without
+
+#ifndef C4LIB // c4lib.c keeps these in the context of each program
 char *p, *lp, // current position in source code
-     *data;   // data/bss pointer
+     **srcs,  // start of each mapped source file
+     **srcv,  // source file names
+     *fname,  // name of the file being parsed
+     *data,   // data/bss pointer
+     *dlim;   // end of data area, less room for the data emitted between two tokens
 
 int *e, *le,  // current position in emitted code
+    *text,    // start of emitted code
+    *elim,    // end of text area, less room for the code emitted between two tokens
+    *srcmap,  // maps a bytecode into its source file number << 24 | line number
+    *reloc,   // bytecode cache header followed by its relocation table
+    *rlp,     // last relocation entry
     *id,      // currently parsed indentifier
     *sym,     // symbol table (simple list of identifiers)
+    *symend,  // first free symbol table entry
+    *symlim,  // end of symbol area
+    *hsym,    // hash index into sym (open addressing)
+    *cas,     // value and address of each case of the switches being parsed
+    *caslim,  // end of case area
+    *swt,     // cases of the innermost switch, from swt + 1 to cas
+    *dft,     // its default
+    *brks,    // breaks out of the innermost switch or loop: their JMPs, chained through the operands up to text
+    hmask,    // hash index size - 1
     tk,       // current token
     ival,     // current token value
     ty,       // current expression type
     loc,      // local variable offset
     line,     // current line number
+    fno,      // current source file number
+    nsrc,     // number of source files
     src,      // print source and assembly flag
-    debug;    // print executed instructions
+    debug,    // print executed instructions
+    wsize,    // bytes in an int
+    wshift;   // log2 of wsize
+#endif
 
 // tokens and classes (operators last and in precedence order)
 enum {
   Num = 128, Fun, Sys, Glo, Loc, Id,
-  Char, Else, Enum, If, Int, Return, While,
+  Char, Else, Enum, If, Int, Return, While, Break, Case, Default, Switch,
   Assign, Cond, Lor, Lan, Or, Xor, And, Eq, Ne, Lt, Gt, Le, Ge, Shl, Shr, Add, Sub, Mul, Div, Mod, Inc, Dec, Brak
 };
 
 // opcodes
-enum { LEA ,IMM ,JMP ,JSR ,BZ  ,BNZ ,ENT ,ADJ ,LEV ,LI  ,LC  ,SI  ,SC  ,PSH ,
+enum { LEA ,IMM ,JMP ,JSR ,BZ  ,BNZ ,ENT ,ADJ ,TAD ,SWT ,
+       LLI ,LLC ,PLLI,PLEA,PSHI,ADDI,SUBI,MULI,SHLI,EQI ,NEI ,BEQ ,BNE ,BLT ,BGE ,BGT ,BLE , // superinstructions (see peephole below)
+       LEV ,LI  ,LC  ,SI  ,SC  ,PSH ,
        OR  ,XOR ,AND ,EQ  ,NE  ,LT  ,GT  ,LE  ,GE  ,SHL ,SHR ,ADD ,SUB ,MUL ,DIV ,MOD ,
-       OPEN,READ,CLOS,PRTF,MALC,MSET,MCMP,EXIT };
+       OPEN,READ,CLOS,PRTF,MALC,FREE,MRST,MSET,MCMP,MMAP,MUNM,MCPY,LSEK,WRIT,DPRF,SPRF,EXIT };
 
 // types
 enum { CHAR, INT, PTR };
@@ -42,23 +74,25 @@ enum { CHAR, INT, PTR };
 // identifier offsets (since we can't create an ident struct)
 enum { Tk, Hash, Name, Class, Type, Val, HClass, HType, HVal, Idsz };
 
+// bytecode cache header offsets; the header is followed by the relocation table, the text and the data
+enum { CMagic, CHash, CText, CData, CNrel, CTlen, CDlen, CMain, CHsz };
+
+// allocator state offsets: the free list of each size class from 1 to MCls, the bump pointer and end of the current arena,
+// the arenas and the large blocks mapped on their own, then the statistics printed at exit
+enum { MCls = 28, MBump, MLim, MArena, MBig, MNalloc, MNfree, MUse, MPeak, MMapped, MSz };
+enum { MArenaSz = 4194304 }; // bytes in an arena
+
 next()
 {
   char *pp;
+  int h;
 
+  if (e > elim) { printf("%s:%d: text area exhausted\n", fname, line); exit(-1); }
+  if (data > dlim) { printf("%s:%d: data area exhausted\n", fname, line); exit(-1); }
   while (tk = *p) {
     ++p;
     if (tk == '\n') {
-      if (src) {
-        printf("%d: %.*s", line, p - lp, lp);
-        lp = p;
-        while (le < e) {
-          printf("%8.4s", &"LEA ,IMM ,JMP ,JSR ,BZ  ,BNZ ,ENT ,ADJ ,LEV ,LI  ,LC  ,SI  ,SC  ,PSH ,"
-                           "OR  ,XOR ,AND ,EQ  ,NE  ,LT  ,GT  ,LE  ,GE  ,SHL ,SHR ,ADD ,SUB ,MUL ,DIV ,MOD ,"
-                           "OPEN,READ,CLOS,PRTF,MALC,MSET,MCMP,EXIT,"[*++le * 5]);
-          if (*le <= ADJ) printf(" %d\n", *++le); else printf("\n");
-        }
-      }
+      while (le < e) srcmap[++le - text] = fno << 24 | line;
       ++line;
     }
     else if (tk == '#') {
@@ -69,11 +103,25 @@ next()
       while ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9') || *p == '_')
         tk = tk * 147 + *p++;
       tk = (tk << 6) + (p - pp);
-      id = sym;
-      while (id[Tk]) {
+      h = (tk >> 6 ^ tk) & hmask;
+      while (id = (int *)hsym[h]) {
         if (tk == id[Hash] && !memcmp((char *)id[Name], pp, p - pp)) { tk = id[Tk]; return; }
-        id = id + Idsz;
+        h = (h + 1) & hmask;
+      }
+      if (symend >= symlim) { printf("%s:%d: symbol area exhausted\n", fname, line); exit(-1); }
+      if ((symend - sym) * 2 >= (hmask + 1) * Idsz) { // keep the index at most half full: double it and rehash
+        hmask = hmask * 2 + 1;
+        memset(hsym, 0, (char *)(hsym + hmask + 1) - (char *)hsym);
+        id = sym;
+        while (id < symend) {
+          h = (id[Hash] >> 6 ^ id[Hash]) & hmask;
+          while (hsym[h]) h = (h + 1) & hmask;
+          hsym[h] = (int)id; id = id + Idsz;
+        }
+        h = (tk >> 6 ^ tk) & hmask;
+        while (hsym[h]) h = (h + 1) & hmask;
       }
+      hsym[h] = (int)(id = symend); symend = symend + Idsz;
       id[Name] = (int)pp;
       id[Hash] = tk;
       tk = id[Tk] = Id;
@@ -101,7 +149,10 @@ next()
         if ((ival = *p++) == '\\') {
           if ((ival = *p++) == 'n') ival = '\n';
         }
-        if (tk == '"') *data++ = ival;
+        if (tk == '"') {
+          if (data >= dlim) { printf("%s:%d: data area exhausted\n", fname, line); exit(-1); }
+          *data++ = ival;
+        }
       }
       ++p;
       if (tk == '"') ival = (int)pp; else tk = Num;
@@ -122,18 +173,24 @@ next()
     else if (tk == '?') { tk = Cond; return; }
     else if (tk == '~' || tk == ';' || tk == '{' || tk == '}' || tk == '(' || tk == ')' || tk == ']' || tk == ',' || tk == ':') return;
   }
+  if (fno < nsrc - 1) { // end of this file: carry on with the next one of the translation unit
+    while (le < e) srcmap[++le - text] = fno << 24 | line;
+    lp = p = srcs[++fno]; fname = srcv[fno]; line = 1;
+    next();
+  }
 }
 
 expr(int lev)
 {
-  int t, *d;
+  int t, *d, *b;
 
-  if (!tk) { printf("%d: unexpected eof in expression\n", line); exit(-1); }
+  b = e; // the code of this expression starts at b + 1: when that is just "IMM n", it is a constant
+  if (!tk) { printf("%s:%d: unexpected eof in expression\n", fname, line); exit(-1); }
   else if (tk == Num) { *++e = IMM; *++e = ival; next(); ty = INT; }
   else if (tk == '"') {
-    *++e = IMM; *++e = ival; next();
+    *++e = IMM; *++rlp = e - text; *++e = ival; next();
     while (tk == '"') next();
-    data = (char *)((int)data + 4 & -4); ty = PTR;
+    data = (char *)((int)data + wsize & -wsize); ty = PTR;
   }
   else if (tk == Id) {
     d = id; next();
@@ -144,15 +201,15 @@ expr(int lev)
       next();
       if (d[Class] == Sys) *++e = d[Val];
       else if (d[Class] == Fun) { *++e = JSR; *++e = d[Val]; }
-      else { printf("%d: bad function call\n", line); exit(-1); }
+      else { printf("%s:%d: bad function call\n", fname, line); exit(-1); }
       if (t) { *++e = ADJ; *++e = t; }
       ty = d[Type];
     }
     else if (d[Class] == Num) { *++e = IMM; *++e = d[Val]; ty = INT; }
     else {
       if (d[Class] == Loc) { *++e = LEA; *++e = loc - d[Val]; }
-      else if (d[Class] == Glo) { *++e = IMM; *++e = d[Val]; }
-      else { printf("%d: undefined variable\n", line); exit(-1); }
+      else if (d[Class] == Glo) { *++e = IMM; *++rlp = e - text; *++e = d[Val]; }
+      else { printf("%s:%d: undefined variable\n", fname, line); exit(-1); }
       *++e = ((ty = d[Type]) == CHAR) ? LC : LI;
     }
   }
@@ -161,57 +218,65 @@ expr(int lev)
     if (tk == Int || tk == Char) {
       t = (tk == Int) ? INT : CHAR; next();
       while (tk == Mul) { next(); t = t + PTR; }
-      if (tk == ')') next(); else { printf("%d: bad cast\n", line); exit(-1); }
+      if (tk == ')') next(); else { printf("%s:%d: bad cast\n", fname, line); exit(-1); }
       expr(Inc);
       ty = t;
     }
     else {
       expr(Assign);
-      if (tk == ')') next(); else { printf("%d: close paren expected\n", line); exit(-1); }
+      if (tk == ')') next(); else { printf("%s:%d: close paren expected\n", fname, line); exit(-1); }
     }
   }
   else if (tk == Mul) {
     next(); expr(Inc);
-    if (ty > INT) ty = ty - PTR; else { printf("%d: bad dereference\n", line); exit(-1); }
+    if (ty > INT) ty = ty - PTR; else { printf("%s:%d: bad dereference\n", fname, line); exit(-1); }
     *++e = (ty == CHAR) ? LC : LI;
   }
   else if (tk == And) {
     next(); expr(Inc);
-    if (*e == LC || *e == LI) --e; else { printf("%d: bad address-of\n", line); exit(-1); }
+    if (*e == LC || *e == LI) --e; else { printf("%s:%d: bad address-of\n", fname, line); exit(-1); }
     ty = ty + PTR;
   }
-  else if (tk == '!') { next(); expr(Inc); *++e = PSH; *++e = IMM; *++e = 0; *++e = EQ; ty = INT; }
-  else if (tk == '~') { next(); expr(Inc); *++e = PSH; *++e = IMM; *++e = -1; *++e = XOR; ty = INT; }
+  else if (tk == '!') { // unary operators on a constant are folded; data addresses (in reloc) are left alone
+    next(); expr(Inc);
+    if (e == b + 2 && b[1] == IMM && *rlp <= b - text) b[2] = !b[2]; else { *++e = PSH; *++e = IMM; *++e = 0; *++e = EQ; }
+    ty = INT;
+  }
+  else if (tk == '~') {
+    next(); expr(Inc);
+    if (e == b + 2 && b[1] == IMM && *rlp <= b - text) b[2] = ~b[2]; else { *++e = PSH; *++e = IMM; *++e = -1; *++e = XOR; }
+    ty = INT;
+  }
   else if (tk == Add) { next(); expr(Inc); ty = INT; }
   else if (tk == Sub) {
-    next(); *++e = IMM;
-    if (tk == Num) { *++e = -ival; next(); } else { *++e = -1; *++e = PSH; expr(Inc); *++e = MUL; }
+    next(); expr(Inc);
+    if (e == b + 2 && b[1] == IMM && *rlp <= b - text) b[2] = -b[2]; else { *++e = PSH; *++e = IMM; *++e = -1; *++e = MUL; }
     ty = INT;
   }
   else if (tk == Inc || tk == Dec) {
     t = tk; next(); expr(Inc);
     if (*e == LC) { *e = PSH; *++e = LC; }
     else if (*e == LI) { *e = PSH; *++e = LI; }
-    else { printf("%d: bad lvalue in pre-increment\n", line); exit(-1); }
+    else { printf("%s:%d: bad lvalue in pre-increment\n", fname, line); exit(-1); }
     *++e = PSH;
-    *++e = IMM; *++e = (ty > PTR) ? 4 : 1;
+    *++e = IMM; *++e = (ty > PTR) ? wsize : 1;
     *++e = (t == Inc) ? ADD : SUB;
     *++e = (ty == CHAR) ? SC : SI;
   }
-  else { printf("%d: bad expression\n", line); exit(-1); }
+  else { printf("%s:%d: bad expression\n", fname, line); exit(-1); }
 
   while (tk >= lev) { // "precedence climbing" or "Top Down Operator Precedence" method
     t = ty;
     if (tk == Assign) {
       next();
-      if (*e == LC || *e == LI) *e = PSH; else { printf("%d: bad lvalue in assignment\n", line); exit(-1); }
+      if (*e == LC || *e == LI) *e = PSH; else { printf("%s:%d: bad lvalue in assignment\n", fname, line); exit(-1); }
       expr(Assign); *++e = ((ty = t) == CHAR) ? SC : SI;
     }
     else if (tk == Cond) {
       next();
       *++e = BZ; d = ++e;
       expr(Assign);
-      if (tk == ':') next(); else { printf("%d: conditional missing colon\n", line); exit(-1); }
+      if (tk == ':') next(); else { printf("%s:%d: conditional missing colon\n", fname, line); exit(-1); }
       *d = (int)(e + 3); *++e = JMP; d = ++e;
       expr(Cond);
       *d = (int)(e + 1);
@@ -229,51 +294,90 @@ expr(int lev)
     else if (tk == Ge)  { next(); *++e = PSH; expr(Shl); *++e = GE;  ty = INT; }
     else if (tk == Shl) { next(); *++e = PSH; expr(Add); *++e = SHL; ty = INT; }
     else if (tk == Shr) { next(); *++e = PSH; expr(Add); *++e = SHR; ty = INT; }
-    else if (tk == Add) {
-      next(); *++e = PSH; expr(Mul);
-      if ((ty = t) > PTR) { *++e = PSH; *++e = IMM; *++e = 4; *++e = MUL;  }
+    else if (tk == Add) { // an int added to a pointer is scaled by a shift, or right away when it is a constant
+      next(); *++e = PSH; d = e; expr(Mul);
+      if ((ty = t) > PTR) {
+        if (e == d + 2 && d[1] == IMM && *rlp <= d - text) d[2] = d[2] << wshift; else { *++e = PSH; *++e = IMM; *++e = wshift; *++e = SHL; }
+      }
       *++e = ADD;
     }
     else if (tk == Sub) {
-      next(); *++e = PSH; expr(Mul);
-      if ((ty = t) > PTR) { *++e = PSH; *++e = IMM; *++e = 4; *++e = MUL;  }
-      *++e = SUB;
+      next(); *++e = PSH; d = e; expr(Mul);
+      if (t > PTR && t == ty) { *++e = SUB; *++e = PSH; *++e = IMM; *++e = wshift; *++e = SHR; ty = INT; } // pointer difference, exact
+      else {
+        if ((ty = t) > PTR) {
+          if (e == d + 2 && d[1] == IMM && *rlp <= d - text) d[2] = d[2] << wshift; else { *++e = PSH; *++e = IMM; *++e = wshift; *++e = SHL; }
+        }
+        *++e = SUB;
+      }
+    }
+    else if (tk == Mul) {
+      next(); *++e = PSH; d = e; expr(Inc); *++e = MUL; ty = INT;
+      if (e == d + 3 && d[1] == IMM && *rlp <= d - text && d[2] > 1 && !(d[2] & (d[2] - 1))) { // by a power of two: shift
+        t = 0; while ((int)1 << t < d[2]) ++t; // in cell width: the constant may not fit in 32 bits
+        d[2] = t; *e = SHL;
+      }
     }
-    else if (tk == Mul) { next(); *++e = PSH; expr(Inc); *++e = MUL; ty = INT; }
     else if (tk == Div) { next(); *++e = PSH; expr(Inc); *++e = DIV; ty = INT; }
     else if (tk == Mod) { next(); *++e = PSH; expr(Inc); *++e = MOD; ty = INT; }
     else if (tk == Inc || tk == Dec) {
       if (*e == LC) { *e = PSH; *++e = LC; }
       else if (*e == LI) { *e = PSH; *++e = LI; }
-      else { printf("%d: bad lvalue in post-increment\n", line); exit(-1); }
-      *++e = PSH; *++e = IMM; *++e = (ty > PTR) ? 4 : 1;
+      else { printf("%s:%d: bad lvalue in post-increment\n", fname, line); exit(-1); }
+      *++e = PSH; *++e = IMM; *++e = (ty > PTR) ? wsize : 1;
       *++e = (tk == Inc) ? ADD : SUB;
       *++e = (ty == CHAR) ? SC : SI;
-      *++e = PSH; *++e = IMM; *++e = (ty > PTR) ? 4 : 1;
+      *++e = PSH; *++e = IMM; *++e = (ty > PTR) ? wsize : 1;
       *++e = (tk == Inc) ? SUB : ADD;
       next();
     }
     else if (tk == Brak) {
-      next(); *++e = PSH; expr(Assign);
-      if (tk == ']') next(); else { printf("%d: close bracket expected\n", line); exit(-1); }
-      if (t > PTR) { *++e = PSH; *++e = IMM; *++e = 4; *++e = MUL;  }
-      else if (t < PTR) { printf("%d: pointer type expected\n", line); exit(-1); }
+      next(); *++e = PSH; d = e; expr(Assign);
+      if (tk == ']') next(); else { printf("%s:%d: close bracket expected\n", fname, line); exit(-1); }
+      if (t > PTR) {
+        if (e == d + 2 && d[1] == IMM && *rlp <= d - text) d[2] = d[2] << wshift; else { *++e = PSH; *++e = IMM; *++e = wshift; *++e = SHL; }
+      }
+      else if (t < PTR) { printf("%s:%d: pointer type expected\n", fname, line); exit(-1); }
       *++e = ADD;
       *++e = ((ty = t - PTR) == CHAR) ? LC : LI;
     }
-    else { printf("%d: compiler error tk=%d\n", line, tk); exit(-1); }
+    else { printf("%s:%d: compiler error tk=%d\n", fname, line, tk); exit(-1); }
+
+    // "IMM x; PSH; IMM y; op" with no data address: fold it into "IMM x op y" (but leave division by zero,
+    // and by -1, which traps on the lowest value, to run time)
+    if (e == b + 6 && b[1] == IMM && b[3] == PSH && b[4] == IMM && *e >= OR && *e <= MOD && *rlp <= b - text
+        && !(*e >= DIV && (!b[5] || b[5] == -1))) {
+      t = b[5]; d = b + 2;
+      if      (*e == OR)  *d = *d |  t;
+      else if (*e == XOR) *d = *d ^  t;
+      else if (*e == AND) *d = *d &  t;
+      else if (*e == EQ)  *d = *d == t;
+      else if (*e == NE)  *d = *d != t;
+      else if (*e == LT)  *d = *d <  t;
+      else if (*e == GT)  *d = *d >  t;
+      else if (*e == LE)  *d = *d <= t;
+      else if (*e == GE)  *d = *d >= t;
+      else if (*e == SHL) *d = *d << t;
+      else if (*e == SHR) *d = *d >> t;
+      else if (*e == ADD) *d = *d +  t;
+      else if (*e == SUB) *d = *d -  t;
+      else if (*e == MUL) *d = *d *  t;
+      else if (*e == DIV) *d = *d /  t;
+      else                *d = *d %  t;
+      e = d; if (le > e) le = e;
+    }
   }
 }
 
 stmt()
 {
-  int *a, *b;
+  int *a, *b, *c, *d, *f, i, j;
 
   if (tk == If) {
     next();
-    if (tk == '(') next(); else { printf("%d: open paren expected\n", line); exit(-1); }
+    if (tk == '(') next(); else { printf("%s:%d: open paren expected\n", fname, line); exit(-1); }
     expr(Assign);
-    if (tk == ')') next(); else { printf("%d: close paren expected\n", line); exit(-1); }
+    if (tk == ')') next(); else { printf("%s:%d: close paren expected\n", fname, line); exit(-1); }
     *++e = BZ; b = ++e;
     stmt();
     if (tk == Else) {
@@ -286,19 +390,92 @@ stmt()
   else if (tk == While) {
     next();
     a = e + 1;
-    if (tk == '(') next(); else { printf("%d: open paren expected\n", line); exit(-1); }
+    if (tk == '(') next(); else { printf("%s:%d: open paren expected\n", fname, line); exit(-1); }
     expr(Assign);
-    if (tk == ')') next(); else { printf("%d: close paren expected\n", line); exit(-1); }
+    if (tk == ')') next(); else { printf("%s:%d: close paren expected\n", fname, line); exit(-1); }
     *++e = BZ; b = ++e;
+    f = brks; brks = text;
     stmt();
     *++e = JMP; *++e = (int)a;
     *b = (int)(e + 1);
+    while (brks != text) { a = (int *)*brks; *brks = (int)(e + 1); brks = a; }
+    brks = f;
+  }
+  else if (tk == Switch) {
+    next();
+    if (tk == '(') next(); else { printf("%s:%d: open paren expected\n", fname, line); exit(-1); }
+    expr(Assign);
+    if (tk == ')') next(); else { printf("%s:%d: close paren expected\n", fname, line); exit(-1); }
+    *++e = JMP; b = ++e; // to the dispatch, after the body
+    c = swt; d = dft; f = brks; swt = cas; dft = 0; brks = text;
+    stmt();
+    *++e = JMP; *++e = (int)brks; brks = e;
+    *b = (int)(e + 1);
+    a = swt + 3;
+    while (a < cas) { // sort the cases by value
+      b = a; i = *a; j = a[1];
+      while (b > swt + 1 && b[-2] >= i) {
+        if (b[-2] == i) { printf("%s:%d: duplicate case %d\n", fname, line, i); exit(-1); }
+        *b = b[-2]; b[1] = b[-1]; b = b - 2;
+      }
+      *b = i; b[1] = j; a = a + 2;
+    }
+    // SWT n: n cases "IMM value; JMP target" by value and the JMP to the default. The VM bisects them, or indexes
+    // them when their values are consecutive: dense cases, spanning less than twice their number, get the holes filled in
+    *++e = SWT; *++e = (cas - swt) / 2; a = swt + 1;
+    i = *e > 1 && cas[-1] - *a >= 0 && cas[-1] - *a < 2 * *e;
+    if (i) *e = cas[-1] - *a + 1;
+    if (e + 4 * *e + 2 > elim) { printf("%s:%d: text area exhausted\n", fname, line); exit(-1); }
+    j = *a;
+    while (a < cas) {
+      *++e = IMM; *++e = j; *++e = JMP;
+      if (*a == j) { *++e = a[1]; a = a + 2; } else if (dft) *++e = (int)dft; else { *++e = (int)brks; brks = e; }
+      j = i ? j + 1 : *a;
+    }
+    *++e = JMP; if (dft) *++e = (int)dft; else { *++e = (int)brks; brks = e; }
+    while (brks != text) { a = (int *)*brks; *brks = (int)(e + 1); brks = a; }
+    cas = swt; swt = c; dft = d; brks = f;
+  }
+  else if (tk == Case) {
+    next();
+    if (!swt) { printf("%s:%d: case outside of switch\n", fname, line); exit(-1); }
+    b = e; expr(Cond);
+    if (e != b + 2 || b[1] != IMM || *rlp > b - text) { printf("%s:%d: bad case constant\n", fname, line); exit(-1); }
+    if (cas >= caslim) { printf("%s:%d: case area exhausted\n", fname, line); exit(-1); }
+    *++cas = b[2]; *++cas = (int)(b + 1); e = b; if (le > e) le = e;
+    if (tk == ':') next(); else { printf("%s:%d: colon expected\n", fname, line); exit(-1); }
+    stmt();
+  }
+  else if (tk == Default) {
+    next();
+    if (!swt) { printf("%s:%d: default outside of switch\n", fname, line); exit(-1); }
+    if (dft) { printf("%s:%d: duplicate default\n", fname, line); exit(-1); }
+    dft = e + 1;
+    if (tk == ':') next(); else { printf("%s:%d: colon expected\n", fname, line); exit(-1); }
+    stmt();
+  }
+  else if (tk == Break) {
+    next();
+    if (!brks) { printf("%s:%d: break outside of switch or loop\n", fname, line); exit(-1); }
+    *++e = JMP; *++e = (int)brks; brks = e;
+    if (tk == ';') next(); else { printf("%s:%d: semicolon expected\n", fname, line); exit(-1); }
   }
   else if (tk == Return) {
     next();
-    if (tk != ';') expr(Assign);
+    if (tk != ';') {
+      b = e; expr(Assign);
+      // return f(...), when f takes no more arguments than this function: TAD moves them over ours and
+      // drops this frame, then f is jumped to, so that its frame takes the place of this one
+      a = b + 1; c = d = 0;
+      while (a <= e) { // find the last two instructions; nothing may branch to the LEV after them
+        if ((*a == JMP || *a == BZ || *a == BNZ) && a[1] == (int)(e + 1)) b = 0;
+        c = d; d = a; a = a + ((*a < LEV) ? 2 : 1);
+      }
+      if (b && d && *d == JSR) { a = (int *)d[1]; *d = TAD; d[1] = 0; *++e = JMP; *++e = (int)a; }
+      else if (b && c && *c == JSR && *d == ADJ && d[1] < loc) { a = (int *)c[1]; *c = TAD; c[1] = d[1]; *d = JMP; d[1] = (int)a; }
+    }
     *++e = LEV;
-    if (tk == ';') next(); else { printf("%d: semicolon expected\n", line); exit(-1); }
+    if (tk == ';') next(); else { printf("%s:%d: semicolon expected\n", fname, line); exit(-1); }
   }
   else if (tk == '{') {
     next();
@@ -310,47 +487,110 @@ stmt()
   }
   else {
     expr(Assign);
-    if (tk == ';') next(); else { printf("%d: semicolon expected\n", line); exit(-1); }
+    if (tk == ';') next(); else { printf("%s:%d: semicolon expected\n", fname, line); exit(-1); }
   }
 }
 
 main(int argc, char **argv)
 {
-  int fd, bt, ty, poolsz, *idmain;
+  int fd, bt, poolsz, *idmain;
+  int *ls, *lsp; // identifiers shadowed by the current function's parameters and locals
   int *pc, *sp, *bp, a, cycle; // vm registers
+  int *stk; // lowest stack address a function may enter with
+  int *ch; // mapped bytecode cache, when it was built from the same sources
+  char *cfile, *pp; // bytecode cache file
+  int *prof; char *pfile; // instructions executed at each bytecode, and the file the profile goes to
+  char *obuf; int osz, olen, oline; // output buffer, its size, the bytes in it, and whether each line is flushed
+  char *ops; // the name of each opcode, in 5 characters
+  int thread; // -t: run the text as threaded code, see c4thread.h
+  int *mp; // the allocator behind malloc() and free()
   int i, *t; // temps
 
+  cfile = 0; ch = 0; pfile = 0; prof = 0; oline = 0;
   --argc; ++argv;
   if (argc > 0 && **argv == '-' && (*argv)[1] == 's') { src = 1; --argc; ++argv; }
   if (argc > 0 && **argv == '-' && (*argv)[1] == 'd') { debug = 1; --argc; ++argv; }
-  if (argc < 1) { printf("usage: c4 [-s] [-d] file ...\n"); return -1; }
-
-  if ((fd = open(*argv, 0)) < 0) { printf("could not open(%s)\n", *argv); return -1; }
+  if (argc > 0 && **argv == '-' && (*argv)[1] == 'l') { oline = 1; --argc; ++argv; }
+  if (argc > 0 && **argv == '-' && (*argv)[1] == 't') { thread = 1; --argc; ++argv; }
+  if (argc > 1 && **argv == '-' && (*argv)[1] == 'p') { pfile = argv[1]; argc = argc - 2; argv = argv + 2; }
+  if (argc > 1 && **argv == '-' && (*argv)[1] == 'c') { cfile = argv[1]; argc = argc - 2; argv = argv + 2; }
+  if (src || pfile) cfile = 0; // the listing and the profile need the symbols and the source map
+  srcv = argv; nsrc = 1;
+  if (argc > 0 && **argv == '-' && (*argv)[1] == 'm') { // every file up to "--" is part of the program
+    srcv = ++argv; --argc; nsrc = 0;
+    while (nsrc < argc && !(argv[nsrc][0] == '-' && argv[nsrc][1] == '-' && !argv[nsrc][2])) ++nsrc;
+    if (nsrc < argc) { argv[nsrc] = argv[nsrc - 1]; ++argv; --argc; } // "--" becomes the program's argv[0]
+    argv = argv + nsrc - 1; argc = argc - nsrc + 1;
+  }
+  if (argc < 1 || nsrc < 1) { printf("usage: c4 [-s] [-d] [-l] [-t] [-p profile] [-c cache] [-m file ... --] file ...\n"); return -1; }
 
-  poolsz = 256*1024; // arbitrary size
-  if (!(sym = malloc(poolsz))) { printf("could not malloc(%d) symbol area\n", poolsz); return -1; }
-  if (!(le = e = malloc(poolsz))) { printf("could not malloc(%d) text area\n", poolsz); return -1; }
-  if (!(data = malloc(poolsz))) { printf("could not malloc(%d) data area\n", poolsz); return -1; }
-  if (!(sp = malloc(poolsz))) { printf("could not malloc(%d) stack area\n", poolsz); return -1; }
+  // every area is reserved with mmap(0, poolsz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0):
+  // pages are zero filled and only committed once touched, so a large reservation costs nothing up front
+  poolsz = 64*1024*1024;
+  if ((int)(symend = sym = mmap(0, poolsz, 3, 34, -1, 0)) == -1) { printf("could not mmap(%d) symbol area\n", poolsz); return -1; }
+  if ((int)(hsym = mmap(0, 4 * poolsz / Idsz, 3, 34, -1, 0)) == -1) { printf("could not mmap(%d) symbol index area\n", 4 * poolsz / Idsz); return -1; }
+  if ((int)(lsp = ls = mmap(0, poolsz / Idsz, 3, 34, -1, 0)) == -1) { printf("could not mmap(%d) scope area\n", poolsz / Idsz); return -1; }
+  if ((int)(text = le = e = mmap(0, poolsz, 3, 34, -1, 0)) == -1) { printf("could not mmap(%d) text area\n", poolsz); return -1; }
+  if ((int)(srcmap = mmap(0, poolsz, 3, 34, -1, 0)) == -1) { printf("could not mmap(%d) source map area\n", poolsz); return -1; }
+  if ((int)(cas = mmap(0, poolsz, 3, 34, -1, 0)) == -1) { printf("could not mmap(%d) case area\n", poolsz); return -1; }
+  if ((int)(data = mmap(0, poolsz, 3, 34, -1, 0)) == -1) { printf("could not mmap(%d) data area\n", poolsz); return -1; }
+  if ((int)(sp = mmap(0, poolsz, 3, 34, -1, 0)) == -1) { printf("could not mmap(%d) stack area\n", poolsz); return -1; }
+  osz = 1024 * 1024; olen = 0;
+  if ((int)(obuf = mmap(0, osz, 3, 34, -1, 0)) == -1) { printf("could not mmap(%d) output buffer\n", osz); return -1; }
+  if ((int)(reloc = mmap(0, poolsz, 3, 34, -1, 0)) == -1) { printf("could not mmap(%d) relocation area\n", poolsz); return -1; }
+  if (pfile && (int)(prof = mmap(0, poolsz, 3, 34, -1, 0)) == -1) { printf("could not mmap(%d) profile area\n", poolsz); return -1; }
+  symlim = (int *)((int)sym + poolsz) - Idsz;
+  caslim = (int *)((int)cas + poolsz) - 2;
+  elim = (int *)((int)text + poolsz) - 1024;
+  dlim = data + poolsz - 1024;
+  hmask = 1023; // grows with the symbol table
+  wsize = (char *)(text + 1) - (char *)text; wshift = 0; while (1 << wshift < wsize) ++wshift;
+  if ((int)(mp = mmap(0, MSz * wsize, 3, 34, -1, 0)) == -1) { printf("could not mmap(%d) allocator state\n", MSz * wsize); return -1; }
+  rlp = reloc + CHsz - 1;
+  reloc[CMagic] = (('c' << 8 | '4') << 8 | EXIT) << 8 | wsize; // opcode set and word size
+  reloc[CText] = (int)text; reloc[CData] = (int)data;
 
-  memset(sym,  0, poolsz);
-  memset(e,    0, poolsz);
-  memset(data, 0, poolsz);
+  ops = "LEA ,IMM ,JMP ,JSR ,BZ  ,BNZ ,ENT ,ADJ ,TAD ,SWT ,"
+        "LLI ,LLC ,PLLI,PLEA,PSHI,ADDI,SUBI,MULI,SHLI,EQI ,NEI ,BEQ ,BNE ,BLT ,BGE ,BGT ,BLE ,"
+        "LEV ,LI  ,LC  ,SI  ,SC  ,PSH ,"
+        "OR  ,XOR ,AND ,EQ  ,NE  ,LT  ,GT  ,LE  ,GE  ,SHL ,SHR ,ADD ,SUB ,MUL ,DIV ,MOD ,"
+        "OPEN,READ,CLOS,PRTF,MALC,FREE,MRST,MSET,MCMP,MMAP,MUNM,MCPY,LSEK,WRIT,DPRF,SPRF,EXIT,";
+  p = "char else enum if int return while break case default switch";
+  i = Char; while (*p) { next(); id[Tk] = i++; } // add keywords to symbol table
+  // the library: a builtin is named here, in the order of its opcode from OPEN on, and run at the end of the VM loop
+  p = "open read close printf malloc free mreset memset memcmp mmap munmap memcpy lseek write dprintf snprintf exit";
+  i = OPEN; while (*p) { next(); id[Class] = Sys; id[Type] = INT; id[Val] = i++; } // add library to symbol table
+  p = "main"; next(); idmain = id; // keep track of main
 
-  p = "char else enum if int return while "
-      "open read close printf malloc memset memcmp exit main";
-  i = Char; while (i <= While) { next(); id[Tk] = i++; } // add keywords to symbol table
-  i = OPEN; while (i <= EXIT) { next(); id[Class] = Sys; id[Type] = INT; id[Val] = i++; } // add library to symbol table
-  next(); idmain = id; // keep track of main
+  // map each source file read-only without copying it: the file is mapped over an anonymous
+  // mapping one byte longer (PROT_READ, MAP_PRIVATE | MAP_FIXED), so the zero fill past its end terminates it
+  if (!(srcs = malloc((char *)(srcv + nsrc) - (char *)srcv))) { printf("could not malloc(%d) source list\n", nsrc); return -1; }
+  fno = 0;
+  while (fno < nsrc) {
+    if ((fd = open(srcv[fno], 0)) < 0) { printf("could not open(%s)\n", srcv[fno]); return -1; }
+    if ((i = lseek(fd, 0, 2)) < 0) { printf("could not lseek(%s)\n", srcv[fno]); return -1; }
+    if ((int)(srcs[fno] = mmap(0, i + 1, 1, 34, -1, 0)) == -1) { printf("could not mmap(%d) source area\n", i + 1); return -1; }
+    if (i && (int)mmap(srcs[fno], i, 1, 18, fd, 0) == -1) { printf("could not mmap(%s)\n", srcv[fno]); return -1; }
+    close(fd);
+    ++fno;
+  }
 
-  if (!(lp = p = malloc(poolsz))) { printf("could not malloc(%d) source area\n", poolsz); return -1; }
-  if ((i = read(fd, p, poolsz-1)) <= 0) { printf("read() returned %d\n", i); return -1; }
-  p[i] = 0;
-  close(fd);
+  // the cache holds an image compiled from sources with the same hash, ready to run after relocation
+  if (cfile) {
+    fno = 0;
+    while (fno < nsrc) { pp = srcs[fno++]; while (*pp) reloc[CHash] = reloc[CHash] * 147 + *pp++; reloc[CHash] = reloc[CHash] * 147 + 1; }
+    if ((fd = open(cfile, 0)) >= 0) {
+      i = lseek(fd, 0, 2);
+      if (i < (char *)(reloc + CHsz) - (char *)reloc || (int)(ch = mmap(0, i, 3, 2, fd, 0)) == -1) ch = 0;
+      else if (ch[CMagic] != reloc[CMagic] || ch[CHash] != reloc[CHash]
+               || i != (char *)(ch + CHsz + ch[CNrel] + ch[CTlen]) - (char *)ch + ch[CDlen]) ch = 0;
+      close(fd);
+    }
+  }
 
   // parse declarations
-  line = 1;
-  next();
+  lp = p = *srcs; fname = *srcv; fno = 0; line = 1;
+  if (ch) tk = 0; else next(); // nothing to parse when the cache is used
   while (tk) {
     bt = INT; // basetype
     if (tk == Int) next();
@@ -362,11 +602,11 @@ main(int argc, char **argv)
         next();
         i = 0;
         while (tk != '}') {
-          if (tk != Id) { printf("%d: bad enum identifier %d\n", line, tk); return -1; }
+          if (tk != Id) { printf("%s:%d: bad enum identifier %d\n", fname, line, tk); return -1; }
           next();
           if (tk == Assign) {
             next();
-            if (tk != Num) { printf("%d: bad enum initializer\n", line); return -1; }
+            if (tk != Num) { printf("%s:%d: bad enum initializer\n", fname, line); return -1; }
             i = ival;
             next();
           }
@@ -379,8 +619,8 @@ main(int argc, char **argv)
     while (tk != ';' && tk != '}') {
       ty = bt;
       while (tk == Mul) { next(); ty = ty + PTR; }
-      if (tk != Id) { printf("%d: bad global declaration\n", line); return -1; }
-      if (id[Class]) { printf("%d: duplicate global definition\n", line); return -1; }
+      if (tk != Id) { printf("%s:%d: bad global declaration\n", fname, line); return -1; }
+      if (id[Class]) { printf("%s:%d: duplicate global definition\n", fname, line); return -1; }
       next();
       id[Type] = ty;
       if (tk == '(') { // function
@@ -392,8 +632,9 @@ main(int argc, char **argv)
           if (tk == Int) next();
           else if (tk == Char) { next(); ty = CHAR; }
           while (tk == Mul) { next(); ty = ty + PTR; }
-          if (tk != Id) { printf("%d: bad parameter declaration\n", line); return -1; }
-          if (id[Class] == Loc) { printf("%d: duplicate parameter definition\n", line); return -1; }
+          if (tk != Id) { printf("%s:%d: bad parameter declaration\n", fname, line); return -1; }
+          if (id[Class] == Loc) { printf("%s:%d: duplicate parameter definition\n", fname, line); return -1; }
+          *++lsp = (int)id;
           id[HClass] = id[Class]; id[Class] = Loc;
           id[HType]  = id[Type];  id[Type] = ty;
           id[HVal]   = id[Val];   id[Val] = i++;
@@ -401,7 +642,7 @@ main(int argc, char **argv)
           if (tk == ',') next();
         }
         next();
-        if (tk != '{') { printf("%d: bad function definition\n", line); return -1; }
+        if (tk != '{') { printf("%s:%d: bad function definition\n", fname, line); return -1; }
         loc = ++i;
         next();
         while (tk == Int || tk == Char) {
@@ -410,8 +651,9 @@ main(int argc, char **argv)
           while (tk != ';') {
             ty = bt;
             while (tk == Mul) { next(); ty = ty + PTR; }
-            if (tk != Id) { printf("%d: bad local declaration\n", line); return -1; }
-            if (id[Class] == Loc) { printf("%d: duplicate local definition\n", line); return -1; }
+            if (tk != Id) { printf("%s:%d: bad local declaration\n", fname, line); return -1; }
+            if (id[Class] == Loc) { printf("%s:%d: duplicate local definition\n", fname, line); return -1; }
+            *++lsp = (int)id;
             id[HClass] = id[Class]; id[Class] = Loc;
             id[HType]  = id[Type];  id[Type] = ty;
             id[HVal]   = id[Val];   id[Val] = ++i;
@@ -423,30 +665,116 @@ main(int argc, char **argv)
         *++e = ENT; *++e = i - loc;
         while (tk != '}') stmt();
         *++e = LEV;
-        id = sym; // unwind symbol table locals
-        while (id[Tk]) {
-          if (id[Class] == Loc) {
-            id[Class] = id[HClass];
-            id[Type] = id[HType];
-            id[Val] = id[HVal];
-          }
-          id = id + Idsz;
+        while (lsp > ls) { // unwind symbol table locals
+          id = (int *)*lsp--;
+          id[Class] = id[HClass];
+          id[Type] = id[HType];
+          id[Val] = id[HVal];
         }
       }
       else {
         id[Class] = Glo;
         id[Val] = (int)data;
-        data = data + 4;
+        data = data + wsize;
       }
       if (tk == ',') next();
     }
     next();
   }
+  while (le < e) srcmap[++le - text] = fno << 24 | line;
+
+  // peephole: fuse common sequences into superinstructions
+  t = sp; memset(t, 0, (char *)(e + 2) - (char *)text); // the stack area is still unused: mark branch targets in it
+  pc = text + 1;
+  while (pc <= e) {
+    i = *pc++;
+    if (i == JMP || i == JSR || i == BZ || i == BNZ) t[(int *)*pc - text] = 1;
+    if (i < LEV) ++pc;
+  }
+  pc = le = text + 1; // pc reads the old code, le writes the fused code, t maps old to new
+  while (pc <= e) {
+    i = *pc; a = pc[1];
+    t[pc - text] = le - text; srcmap[le - text] = srcmap[pc - text];
+    if (i == LEA && pc[2] == LI && pc[3] == PSH && !t[pc + 2 - text] && !t[pc + 3 - text]) { // push local
+      *le++ = PLLI; *le++ = a; pc = pc + 4;
+    }
+    else if (i == LEA && (pc[2] == LI || pc[2] == LC || pc[2] == PSH) && !t[pc + 2 - text]) { // load local
+      *le++ = (pc[2] == LI) ? LLI : (pc[2] == LC) ? LLC : PLEA; *le++ = a; pc = pc + 3;
+    }
+    else if (i == IMM && pc[2] == PSH && !t[pc + 2 - text]) { *le++ = PSHI; *le++ = a; pc = pc + 3; } // push immediate
+    else if (i == PSH && a == IMM && !t[pc + 1 - text] && !t[pc + 3 - text] // operate with immediate
+             && (pc[3] == ADD || pc[3] == SUB || pc[3] == MUL || pc[3] == SHL || pc[3] == EQ || pc[3] == NE)) {
+      a = pc[2]; i = pc[3]; t[pc + 1 - text] = le - text; // the IMM may be in the relocation table
+      *le++ = (i == ADD) ? ADDI : (i == SUB) ? SUBI : (i == MUL) ? MULI : (i == SHL) ? SHLI : (i == EQ) ? EQI : NEI; *le++ = a; pc = pc + 4;
+    }
+    else if (i >= EQ && i <= GE && a == BZ && !t[pc + 1 - text]) { // compare and branch if false
+      *le++ = (i == EQ) ? BNE : (i == NE) ? BEQ : (i == LT) ? BGE : (i == GT) ? BLE : (i == LE) ? BGT : BLT;
+      *le++ = pc[2]; pc = pc + 3;
+    }
+    else { *le++ = i; ++pc; if (i < LEV) *le++ = *pc++; }
+  }
+  e = le - 1;
+  pc = text + 1; // relocate branch targets and function entries
+  while (pc <= e) {
+    i = *pc++;
+    if (i == JMP || i == JSR || i == BZ || i == BNZ || (i >= BEQ && i <= BLE)) *pc = (int)(text + t[(int *)*pc - text]);
+    if (i < LEV) ++pc;
+  }
+  id = sym;
+  while (id[Tk]) {
+    if (id[Class] == Fun) id[Val] = (int)(text + t[(int *)id[Val] - text]);
+    id = id + Idsz;
+  }
+
+  if (ch) { // relocate the cached text and data to where they were mapped
+    rlp = ch + CHsz; text = rlp + ch[CNrel]; e = text + ch[CTlen] - 1; data = (char *)(e + 1);
+    while (rlp < text) {
+      i = *rlp++;
+      if (i > 0) text[i] = text[i] - ch[CText] + (int)text; else text[-i] = text[-i] - ch[CData] + (int)data;
+    }
+    idmain[Val] = (int)(text + ch[CMain]);
+  }
+  else if (cfile && idmain[Val]) { // save the compiled image: positive entries hold text addresses, negative ones data addresses
+    pc = reloc + CHsz; while (pc <= rlp) { *pc = -(t[*pc] + 1); ++pc; }
+    pc = text + 1;
+    while (pc <= e) {
+      i = *pc++;
+      if (i == JMP || i == JSR || i == BZ || i == BNZ || (i >= BEQ && i <= BLE)) *++rlp = pc - text;
+      if (i < LEV) ++pc;
+    }
+    reloc[CNrel] = rlp - reloc - CHsz + 1; reloc[CTlen] = e - text + 1; reloc[CDlen] = data - (char *)reloc[CData];
+    reloc[CMain] = (int *)idmain[Val] - text;
+    if ((fd = open(cfile, 577, 420)) < 0) { printf("could not open(%s)\n", cfile); return -1; } // O_WRONLY | O_CREAT | O_TRUNC, 0644
+    write(fd, (char *)reloc, (char *)(rlp + 1) - (char *)reloc);
+    write(fd, (char *)text, (char *)(e + 1) - (char *)text);
+    write(fd, (char *)reloc[CData], reloc[CDlen]);
+    close(fd);
+  }
 
   if (!(pc = (int *)idmain[Val])) { printf("main() not defined\n"); return -1; }
-  if (src) return 0;
+  if (src) { // print source and assembly
+    pc = text + 1; lp = *srcs; fno = line = 0;
+    if (nsrc > 1) printf("%s:\n", *srcv);
+    while (pc <= e || *lp || fno < nsrc - 1) {
+      if ((*lp || fno < nsrc - 1) && (pc > e || (fno << 24 | line) < srcmap[pc - text])) {
+        if (!*lp) { lp = srcs[++fno]; line = 0; printf("%s:\n", srcv[fno]); }
+        else {
+          p = lp; while (*p && *p != '\n') ++p;
+          printf("%d: %.*s\n", ++line, p - lp, lp);
+          lp = *p ? p + 1 : p;
+        }
+      }
+      else {
+        i = *pc++;
+        printf("%8.4s", ops + i * 5);
+        if (i < LEV) printf(" %d\n", *pc++); else printf("\n");
+      }
+    }
+    return 0;
+  }
 
   // setup stack
+  stk = sp + 1024; // room for the temporaries and arguments pushed below a frame
   sp = (int *)((int)sp + poolsz);
   *--sp = EXIT; // call exit if main returns
   *--sp = PSH; t = sp;
@@ -456,55 +784,252 @@ main(int argc, char **argv)
 
   // run...
   cycle = 0;
+#include "c4thread.h"
   while (1) {
     i = *pc++; ++cycle;
-    if (debug) {
-      printf("%d> %.4s", cycle,
-        &"LEA ,IMM ,JMP ,JSR ,BZ  ,BNZ ,ENT ,ADJ ,LEV ,LI  ,LC  ,SI  ,SC  ,PSH ,"
-         "OR  ,XOR ,AND ,EQ  ,NE  ,LT  ,GT  ,LE  ,GE  ,SHL ,SHR ,ADD ,SUB ,MUL ,DIV ,MOD ,"
-         "OPEN,READ,CLOS,PRTF,MALC,MSET,MCMP,EXIT,"[i * 5]);
-      if (i <= ADJ) printf(" %d\n", *pc); else printf("\n");
-    }
-    if      (i == LEA) a = (int)(bp + *pc++);                             // load local address
-    else if (i == IMM) a = *pc++;                                         // load global address or immediate
-    else if (i == JMP) pc = (int *)*pc;                                   // jump
-    else if (i == JSR) { *--sp = (int)(pc + 1); pc = (int *)*pc; }        // jump to subroutine
-    else if (i == BZ)  pc = a ? pc + 1 : (int *)*pc;                      // branch if zero
-    else if (i == BNZ) pc = a ? (int *)*pc : pc + 1;                      // branch if not zero
-    else if (i == ENT) { *--sp = (int)bp; bp = sp; sp = sp - *pc++; }     // enter subroutine
-    else if (i == ADJ) sp = sp + *pc++;                                   // stack adjust
-    else if (i == LEV) { sp = bp; bp = (int *)*sp++; pc = (int *)*sp++; } // leave subroutine
-    else if (i == LI)  a = *(int *)a;                                     // load int
-    else if (i == LC)  a = *(char *)a;                                    // load char
-    else if (i == SI)  *(int *)*sp++ = a;                                 // store int
-    else if (i == SC)  a = *(char *)*sp++ = a;                            // store char
-    else if (i == PSH) *--sp = a;                                         // push
-
-    else if (i == OR)  a = *sp++ |  a;
-    else if (i == XOR) a = *sp++ ^  a;
-    else if (i == AND) a = *sp++ &  a;
-    else if (i == EQ)  a = *sp++ == a;
-    else if (i == NE)  a = *sp++ != a;
-    else if (i == LT)  a = *sp++ <  a;
-    else if (i == GT)  a = *sp++ >  a;
-    else if (i == LE)  a = *sp++ <= a;
-    else if (i == GE)  a = *sp++ >= a;
-    else if (i == SHL) a = *sp++ << a;
-    else if (i == SHR) a = *sp++ >> a;
-    else if (i == ADD) a = *sp++ +  a;
-    else if (i == SUB) a = *sp++ -  a;
-    else if (i == MUL) a = *sp++ *  a;
-    else if (i == DIV) a = *sp++ /  a;
-    else if (i == MOD) a = *sp++ %  a;
-
-    else if (i == OPEN) a = open((char *)sp[1], *sp);
-    else if (i == READ) a = read(sp[2], (char *)sp[1], *sp);
+#ifdef C4LIB
+#include "c4lib.h"
+#endif
+#include "c4thread.h"
+    if (prof && pc > text && pc <= e + 1) ++prof[pc - 1 - text]; // not the exit stub on the stack
+    if (debug) { // straight out, after the program's output so far
+      if (olen) { write(1, obuf, olen); olen = 0; }
+      dprintf(1, "%ld> %.4s", cycle, ops + i * 5);
+      if (i < LEV) dprintf(1, " %d\n", *pc); else dprintf(1, "\n");
+    }
+    if (i < OPEN) switch (i) { // one indexed jump under gcc and c4 alike, the cases being consecutive; -t threads them
+#include "c4label.h"
+      case LEA:  a = (int)(bp + *pc++); break;                            // load local address
+#include "c4label.h"
+      case IMM:  a = *pc++; break;                                        // load global address or immediate
+#include "c4label.h"
+      case JMP:  pc = (int *)*pc; break;                                  // jump
+#include "c4label.h"
+      case JSR:  *--sp = (int)(pc + 1); pc = (int *)*pc; break;            // jump to subroutine
+#include "c4label.h"
+      case BZ:   pc = a ? pc + 1 : (int *)*pc; break;                     // branch if zero
+#include "c4label.h"
+      case BNZ:  pc = a ? (int *)*pc : pc + 1; break;                     // branch if not zero
+#include "c4label.h"
+      case ENT:                                                           // enter subroutine
+        *--sp = (int)bp; bp = sp; sp = sp - *pc++;
+        if (sp < stk) { write(1, obuf, olen); printf("stack overflow! cycle = %ld\n", cycle); return -1; }
+        break;
+#include "c4label.h"
+      case ADJ:  sp = sp + *pc++; break;                                  // stack adjust
+#include "c4label.h"
+      case TAD: // tail call: move the arguments over those of this frame, leave it, and on to the JMP
+        i = *pc++; while (i) { --i; bp[2 + i] = sp[i]; }
+        sp = bp + 1; bp = (int *)*bp;
+        break;
+#include "c4label.h"
+      case SWT: // switch: take the JMP of the case of a, or the last one, to the default
+        i = *pc++; t = pc; pc = pc + 4 * i;
+        if (i > 1 && t[4 * i - 3] - t[1] == i - 1) { if (a >= t[1] && a <= t[4 * i - 3]) pc = t + 4 * (a - t[1]) + 2; }
+        else {
+          while (i > 1) { if (t[4 * (i / 2) + 1] <= a) { t = t + 4 * (i / 2); i = i - i / 2; } else i = i / 2; }
+          if (i && t[1] == a) pc = t + 2;
+        }
+        pc = (int *)pc[1];
+        break;
+#include "c4label.h"
+      case LLI:  a = *(int *)(bp + *pc++); break;                         // load local int
+#include "c4label.h"
+      case LLC:  a = *(char *)(bp + *pc++); break;                        // load local char
+#include "c4label.h"
+      case PLLI: *--sp = a = *(int *)(bp + *pc++); break;                 // push local int
+#include "c4label.h"
+      case PLEA: *--sp = a = (int)(bp + *pc++); break;                    // push local address
+#include "c4label.h"
+      case PSHI: *--sp = a = *pc++; break;                                // push immediate
+#include "c4label.h"
+      case ADDI: a = a + *pc++; break;
+#include "c4label.h"
+      case SUBI: a = a - *pc++; break;
+#include "c4label.h"
+      case MULI: a = a * *pc++; break;
+#include "c4label.h"
+      case SHLI: a = a << *pc++; break;
+#include "c4label.h"
+      case EQI:  a = a == *pc++; break;
+#include "c4label.h"
+      case NEI:  a = a != *pc++; break;
+      // compare and branch if false
+#include "c4label.h"
+      case BEQ:  a = *sp++ != a; pc = a ? pc + 1 : (int *)*pc; break;
+#include "c4label.h"
+      case BNE:  a = *sp++ == a; pc = a ? pc + 1 : (int *)*pc; break;
+#include "c4label.h"
+      case BLT:  a = *sp++ >= a; pc = a ? pc + 1 : (int *)*pc; break;
+#include "c4label.h"
+      case BGE:  a = *sp++ <  a; pc = a ? pc + 1 : (int *)*pc; break;
+#include "c4label.h"
+      case BGT:  a = *sp++ <= a; pc = a ? pc + 1 : (int *)*pc; break;
+#include "c4label.h"
+      case BLE:  a = *sp++ >  a; pc = a ? pc + 1 : (int *)*pc; break;
+#include "c4label.h"
+      case LEV:  sp = bp; bp = (int *)*sp++; pc = (int *)*sp++; break;     // leave subroutine
+#include "c4label.h"
+      case LI:   a = *(int *)a; break;                                    // load int
+#include "c4label.h"
+      case LC:   a = *(char *)a; break;                                   // load char
+#include "c4label.h"
+      case SI:   *(int *)*sp++ = a; break;                                // store int
+#include "c4label.h"
+      case SC:   a = *(char *)*sp++ = a; break;                           // store char
+#include "c4label.h"
+      case PSH:  *--sp = a; break;                                        // push
+#include "c4label.h"
+      case OR:   a = *sp++ |  a; break;
+#include "c4label.h"
+      case XOR:  a = *sp++ ^  a; break;
+#include "c4label.h"
+      case AND:  a = *sp++ &  a; break;
+#include "c4label.h"
+      case EQ:   a = *sp++ == a; break;
+#include "c4label.h"
+      case NE:   a = *sp++ != a; break;
+#include "c4label.h"
+      case LT:   a = *sp++ <  a; break;
+#include "c4label.h"
+      case GT:   a = *sp++ >  a; break;
+#include "c4label.h"
+      case LE:   a = *sp++ <= a; break;
+#include "c4label.h"
+      case GE:   a = *sp++ >= a; break;
+#include "c4label.h"
+      case SHL:  a = *sp++ << a; break;
+#include "c4label.h"
+      case SHR:  a = *sp++ >> a; break;
+#include "c4label.h"
+      case ADD:  a = *sp++ +  a; break;
+#include "c4label.h"
+      case SUB:  a = *sp++ -  a; break;
+#include "c4label.h"
+      case MUL:  a = *sp++ *  a; break;
+#include "c4label.h"
+      case DIV:  a = *sp++ /  a; break;
+#include "c4label.h"
+      case MOD:  a = *sp++ %  a; break;
+    }
+#undef break
+    else if (i == OPEN) { t = sp + pc[1]; a = open((char *)t[-1], t[-2], t[-3]); } // the mode is only read with O_CREAT
+    else if (i == READ) { // flush the output before waiting for input
+      if (!sp[2] && olen) { write(1, obuf, olen); olen = 0; }
+      a = read(sp[2], (char *)sp[1], *sp);
+    }
     else if (i == CLOS) a = close(*sp);
-    else if (i == PRTF) { t = sp + pc[1]; a = printf((char *)t[-1], t[-2], t[-3], t[-4], t[-5], t[-6]); }
-    else if (i == MALC) a = (int)malloc(*sp);
+    else if (i == PRTF) { // into the output buffer, which is flushed when full, at exit, and with -l at each newline
+      t = sp + pc[1];
+      a = snprintf(obuf + olen, osz - olen, (char *)t[-1], t[-2], t[-3], t[-4], t[-5], t[-6]);
+      if (a >= osz - olen && olen) { write(1, obuf, olen); olen = 0; a = snprintf(obuf, osz, (char *)t[-1], t[-2], t[-3], t[-4], t[-5], t[-6]); }
+      if (a >= osz) a = dprintf(1, (char *)t[-1], t[-2], t[-3], t[-4], t[-5], t[-6]); // longer than the buffer
+      else if (a > 0) {
+        olen = olen + a;
+        if (oline) { pp = obuf + olen - a; while (pp < obuf + olen && *pp != '\n') ++pp; if (pp < obuf + olen) { write(1, obuf, olen); olen = 0; } }
+      }
+    }
+    else if (i == MALC) { // a block of a size class of whole words, from the free list of its class or else from the
+                          // arena, with a bump pointer; larger ones are mapped on their own. The word before a block holds its class
+      if (*sp < 0 || *sp > (int)1 << (wsize * 8 - 2)) a = 0; // more than a quarter of the address space never maps, and would overflow below
+      else {
+        a = (*sp + wsize - 1) >> wshift; if (!a) a = 1; // words, rounded up to those of the class
+        i = a; if (a > 16) { i = 17; while (i <= MCls && 16 << (i - 16) < a) ++i; if (i <= MCls) a = 16 << (i - 16); } // 16 words and up: powers of two
+        if (i <= MCls) {
+          if (t = (int *)mp[i]) mp[i] = *t;
+          else {
+            if (mp[MBump] + (a + 1) * wsize > mp[MLim] && (int)(t = mmap(0, MArenaSz, 3, 34, -1, 0)) != -1) { // a new arena, linked through its first word
+              *t = mp[MArena]; mp[MArena] = (int)t; mp[MBump] = (int)(t + 1); mp[MLim] = (int)t + MArenaSz; mp[MMapped] = mp[MMapped] + MArenaSz;
+            }
+            if (mp[MBump] + (a + 1) * wsize > mp[MLim]) t = 0;
+            else { t = (int *)mp[MBump]; mp[MBump] = (int)(t + a + 1); *t = i; t = t + 1; }
+          }
+        }
+        else if ((int)(t = mmap(0, (a + 3) * wsize, 3, 34, -1, 0)) == -1) t = 0;
+        else { // its size in words instead of a class, after the previous and next large blocks
+          if (t[1] = mp[MBig]) *(int *)mp[MBig] = (int)t;
+          mp[MBig] = (int)t; t[2] = a; t = t + 3; mp[MMapped] = mp[MMapped] + (a + 3) * wsize;
+        }
+        if (t) { ++mp[MNalloc]; mp[MUse] = mp[MUse] + a * wsize; if (mp[MUse] > mp[MPeak]) mp[MPeak] = mp[MUse]; }
+        a = (int)t;
+      }
+    }
+    else if (i == FREE) { // back on the free list of its class, or unmapped when large
+      if (t = (int *)*sp) {
+        if ((i = t[-1]) <= MCls) { *t = mp[i]; mp[i] = (int)t; if (i > 16) i = 16 << (i - 16); }
+        else {
+          t = t - 3;
+          if (*t) ((int *)*t)[1] = t[1]; else mp[MBig] = t[1];
+          if (t[1]) *(int *)t[1] = *t;
+          munmap(t, (i + 3) * wsize); mp[MMapped] = mp[MMapped] - (i + 3) * wsize;
+        }
+        ++mp[MNfree]; mp[MUse] = mp[MUse] - i * wsize;
+      }
+      a = 0;
+    }
+    else if (i == MRST) { // mreset(): free every block at once, for a program that serves one request after another.
+                          // The large blocks and the arenas are unmapped but the current one, which starts over
+      while (t = (int *)mp[MBig]) { mp[MBig] = t[1]; munmap(t, (t[2] + 3) * wsize); }
+      if (t = (int *)mp[MArena]) { while (pp = (char *)*t) { *t = *(int *)pp; munmap(pp, MArenaSz); } mp[MBump] = (int)(t + 1); }
+      i = 1; while (i <= MCls) mp[i++] = 0;
+      mp[MUse] = 0; mp[MMapped] = t ? MArenaSz : 0; a = 0;
+    }
     else if (i == MSET) a = (int)memset((char *)sp[2], sp[1], *sp);
     else if (i == MCMP) a = memcmp((char *)sp[2], (char *)sp[1], *sp);
-    else if (i == EXIT) { printf("exit(%d) cycle = %d\n", *sp, cycle); return *sp; }
-    else { printf("unknown instruction = %d! cycle = %d\n", i, cycle); return -1; }
+    else if (i == MMAP) a = (int)mmap((char *)sp[5], sp[4], sp[3], sp[2], sp[1], *sp);
+    else if (i == MUNM) a = munmap((char *)sp[1], *sp);
+    else if (i == MCPY) a = (int)memcpy((char *)sp[2], (char *)sp[1], *sp);
+    else if (i == LSEK) a = lseek(sp[2], sp[1], *sp);
+    else if (i == WRIT) { // to stdout: into the output buffer as well, unless it does not fit in
+      if (sp[2] != 1 || *sp < 0) a = write(sp[2], (char *)sp[1], *sp); // a bad count fails as it would unbuffered
+      else {
+        if (olen + *sp > osz && olen) { write(1, obuf, olen); olen = 0; }
+        if (*sp >= osz) a = write(1, (char *)sp[1], *sp);
+        else {
+          memcpy(obuf + olen, (char *)sp[1], a = *sp); olen = olen + a;
+          if (oline) { pp = obuf + olen - a; while (pp < obuf + olen && *pp != '\n') ++pp; if (pp < obuf + olen) { write(1, obuf, olen); olen = 0; } }
+        }
+      }
+    }
+    else if (i == DPRF) {
+      t = sp + pc[1]; if (t[-1] == 1 && olen) { write(1, obuf, olen); olen = 0; }
+      a = dprintf(t[-1], (char *)t[-2], t[-3], t[-4], t[-5], t[-6], t[-7]);
+    }
+    else if (i == SPRF) { t = sp + pc[1]; a = snprintf((char *)t[-1], t[-2], (char *)t[-3], t[-4], t[-5], t[-6], t[-7], t[-8]); }
+    else if (i == EXIT) {
+      write(1, obuf, olen);
+      printf("exit(%d) cycle = %ld\n", *sp, cycle);
+      if (mp[MNalloc]) printf("malloc = %ld, free = %ld, bytes in use = %ld, peak = %ld, mapped = %ld\n", mp[MNalloc], mp[MNfree], mp[MUse], mp[MPeak], mp[MMapped]);
+      if (prof) { // fold the bytecode counts into an opcode histogram and counts per function and per source line
+        if ((fd = open(pfile, 577, 420)) < 0) { printf("could not open(%s)\n", pfile); return -1; }
+        i = (char *)(text + EXIT + 1) - (char *)text;
+        if (!(t = malloc(i))) { printf("could not malloc(%d) histogram\n", i); return -1; }
+        memset(t, 0, i);
+        pc = text + 1; while (pc <= e) { t[*pc] = t[*pc] + prof[pc - text]; if (*pc++ < LEV) ++pc; }
+        dprintf(fd, "cycles %ld\nopcodes:\n", cycle);
+        i = 0;
+        while (i <= EXIT) { if (t[i]) dprintf(fd, "%12ld %.4s\n", t[i], ops + i * 5); ++i; }
+        dprintf(fd, "functions:\n"); // a function runs from its ENT up to the next one
+        id = sym;
+        while (id[Tk]) {
+          if (id[Class] == Fun) {
+            pc = (int *)id[Val]; a = prof[pc - text]; pc = pc + 2;
+            while (pc <= e && *pc != ENT) { a = a + prof[pc - text]; if (*pc++ < LEV) ++pc; }
+            if (a) dprintf(fd, "%12ld %.*s\n", a, id[Hash] & 63, (char *)id[Name]);
+          }
+          id = id + Idsz;
+        }
+        dprintf(fd, "lines:\n"); // srcmap does not decrease along the text
+        pc = text + 1;
+        while (pc <= e) {
+          i = srcmap[pc - text]; a = 0;
+          while (pc <= e && srcmap[pc - text] == i) { a = a + prof[pc - text]; if (*pc++ < LEV) ++pc; }
+          if (a) dprintf(fd, "%12ld %s:%d\n", a, srcv[i >> 24], i & 16777215);
+        }
+        close(fd);
+      }
+      return *sp;
+    }
+    else { write(1, obuf, olen); printf("unknown instruction = %d! cycle = %ld\n", i, cycle); return -1; }
   }
 }
@@ -0,0 +1,20 @@
+// c4.h - c4 as a library, see c4lib.c
+
+typedef struct c4 c4;
+
+// compile a program from a c4 command line, argv[0] first: "c4 [-s] [-d] [-l] [-t] [-p profile] [-c cache] [-m file ... --] file ...".
+// Returns 0 when the program does not compile
+c4 *c4_compile(int argc, char **argv);
+
+// run a compiled program for up to n instructions, from where it stopped; returns 1 once it has finished
+int c4_step(c4 *c, int n);
+
+// run a compiled program to the end and return its exit code
+int c4_run(c4 *c);
+
+// run n programs to the end on a pool of threads, each for a slice of instructions at a time, round-robin,
+// so that none waits for more than n / threads slices; then c4_run() returns their exit codes
+int c4_sched(c4 **v, int n, int threads, int slice);
+
+// release everything the compiler and the program allocated
+void c4_free(c4 *c);
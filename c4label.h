@@ -0,0 +1,3 @@
+// c4label.h - included by the C compiler before each case of the VM switch of c4.c, in opcode order: the label
+// that c4thread.h threads the opcode to
+C4LABEL(__COUNTER__):
@@ -0,0 +1,265 @@
+// c4lib.c - c4 as a library: compile and run programs from C, many at once
+//
+// c4.c is compiled in here unchanged. Its globals become the fields of a context, one per program,
+// and its main() runs on a stack of its own that starts with a pointer to that context (c4t finds it
+// from any frame on the stack). main() stops in the VM loop (in c4lib.h) after the compile and whenever
+// the instructions granted by c4_step() are used up, so its locals, the VM registers among them, wait
+// in the context until it goes on. Every thread can compile and run programs without locks, and a
+// program may go on in another thread than the one it stopped in, as the scheduler in c4_sched() does.
+//
+// Build it with gcc -c c4lib.c, link with -lpthread, and see c4.h.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include "c4.h"
+
+#define int intptr_t // the cell of c4.c, up to the end of it
+
+struct c4 {
+  // the globals of c4.c
+  char *p, *lp, **srcs, **srcv, *fname, *data, *dlim;
+  int *e, *le, *text, *elim, *srcmap, *reloc, *rlp, *id, *sym, *symend, *symlim, *hsym,
+      *cas, *caslim, *swt, *dft, *brks,
+      hmask, tk, ival, ty, loc, line, fno, nsrc, src, debug, wsize, wshift;
+
+  // the program
+  int argc; char **argv;
+  int state, status;           // how far main() got, and what it returned
+  int left;                    // instructions main() may still execute before it stops
+  ucontext_t main, caller;     // main() of c4.c, and c4_compile() or c4_step() waiting for it
+  char *stack;                 // the C stack of main(), C4Stack aligned
+  int *maps, nmap, mapsz;      // address and length of every area mmap()ed
+  char *heap;                  // blocks malloc()ed, linked through their first word
+};
+
+enum { C4New, C4Ready, C4Done }; // state: main() not started, stopped, returned
+
+enum { C4Stack = 1024 * 1024 }; // for the recursion of expr() and stmt(); a power of two
+
+// the program that owns the stack this runs on
+#define c4t (*(c4 **)((intptr_t)__builtin_frame_address(0) & -(intptr_t)C4Stack))
+
+static void c4_exit(int n) // an error: main() goes no further
+{
+  c4t->status = n; c4t->state = C4Done;
+  setcontext(&c4t->caller);
+}
+
+static void c4_yield(void)
+{
+  c4t->state = C4Ready;
+  swapcontext(&c4t->main, &c4t->caller);
+}
+
+static int c4_map(int a, int n) // list an area for c4_free()
+{
+  int *m;
+
+  if (c4t->nmap == c4t->mapsz) {
+    if (!(m = realloc(c4t->maps, (c4t->mapsz * 2 + 16) * 2 * sizeof(int)))) return -1;
+    c4t->maps = m; c4t->mapsz = c4t->mapsz * 2 + 16;
+  }
+  c4t->maps[2 * c4t->nmap] = a; c4t->maps[2 * c4t->nmap + 1] = n; ++c4t->nmap;
+  return 0;
+}
+
+static void *c4_mmap(void *a, size_t n, int prot, int flags, int fd, off_t off)
+{
+  a = mmap(a, n, prot, flags, fd, off);
+  if (a == MAP_FAILED || (flags & MAP_FIXED)) return a; // a fixed mapping replaces part of one already listed
+  if (c4_map((int)a, n)) { munmap(a, n); return MAP_FAILED; }
+  return a;
+}
+
+static int c4_munmap(void *a, size_t n) // and take the pages off the list, which c4_free() would unmap again
+{
+  int i, s, end, lo, hi;
+
+  if (munmap(a, n)) return -1;
+  lo = (int)a; hi = (lo + n + getpagesize() - 1) & -(int)getpagesize();
+  for (i = 0; i < c4t->nmap; ++i) {
+    s = c4t->maps[2 * i]; end = s + c4t->maps[2 * i + 1];
+    if (end <= lo || s >= hi) continue;
+    if (s < lo && end > hi) c4_map(hi, end - hi); // the middle is gone: list the end on its own, or leak it
+    if (s < lo) c4t->maps[2 * i + 1] = lo - s;
+    else if (end > hi) { c4t->maps[2 * i] = hi; c4t->maps[2 * i + 1] = end - hi; }
+    else { --c4t->nmap; c4t->maps[2 * i] = c4t->maps[2 * c4t->nmap]; c4t->maps[2 * i + 1] = c4t->maps[2 * c4t->nmap + 1]; --i; }
+  }
+  return 0;
+}
+
+static void *c4_malloc(int n)
+{
+  char *b;
+
+  if (!(b = malloc(n + sizeof(double)))) return 0; // keep the alignment of malloc()
+  *(char **)b = c4t->heap; c4t->heap = b;
+  return b + sizeof(double);
+}
+
+#define p      (c4t->p)
+#define lp     (c4t->lp)
+#define srcs   (c4t->srcs)
+#define srcv   (c4t->srcv)
+#define fname  (c4t->fname)
+#define data   (c4t->data)
+#define dlim   (c4t->dlim)
+#define e      (c4t->e)
+#define le     (c4t->le)
+#define text   (c4t->text)
+#define elim   (c4t->elim)
+#define srcmap (c4t->srcmap)
+#define reloc  (c4t->reloc)
+#define rlp    (c4t->rlp)
+#define id     (c4t->id)
+#define sym    (c4t->sym)
+#define symend (c4t->symend)
+#define symlim (c4t->symlim)
+#define hsym   (c4t->hsym)
+#define cas    (c4t->cas)
+#define caslim (c4t->caslim)
+#define swt    (c4t->swt)
+#define dft    (c4t->dft)
+#define brks   (c4t->brks)
+#define hmask  (c4t->hmask)
+#define tk     (c4t->tk)
+#define ival   (c4t->ival)
+#define ty     (c4t->ty)
+#define loc    (c4t->loc)
+#define line   (c4t->line)
+#define fno    (c4t->fno)
+#define nsrc   (c4t->nsrc)
+#define src    (c4t->src)
+#define debug  (c4t->debug)
+#define wsize  (c4t->wsize)
+#define wshift (c4t->wshift)
+
+#define next c4_next
+#define expr c4_expr
+#define stmt c4_stmt
+#define main c4_main
+#define exit(n) c4_exit(n)
+#define mmap(a, n, prot, flags, fd, off) c4_mmap(a, n, prot, flags, fd, off)
+#define munmap(a, n) c4_munmap(a, n)
+#define malloc(n) c4_malloc(n)
+
+#define C4LIB
+#include "c4.c"
+
+#undef int
+#undef main
+#undef exit
+#undef mmap
+#undef munmap
+#undef malloc
+
+static void c4_start(void)
+{
+  c4t->status = c4_main(c4t->argc, c4t->argv);
+  c4t->state = C4Done;
+} // and back to the caller through uc_link
+
+c4 *c4_compile(int argc, char **argv)
+{
+  c4 *c;
+  char *s;
+
+  if (!(c = calloc(1, sizeof(c4)))) return 0;
+  // twice the size, less the ends, leaves one aligned stack
+  if ((s = mmap(0, 2 * C4Stack, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) { free(c); return 0; }
+  c->stack = (char *)((intptr_t)(s + C4Stack - 1) & -(intptr_t)C4Stack);
+  if (c->stack > s) munmap(s, c->stack - s);
+  if (c->stack < s + C4Stack) munmap(c->stack + C4Stack, s + C4Stack - c->stack);
+  *(c4 **)c->stack = c;
+
+  c->argc = argc; c->argv = argv;
+  getcontext(&c->main);
+  c->main.uc_stack.ss_sp = c->stack + 64; c->main.uc_stack.ss_size = C4Stack - 64; c->main.uc_link = &c->caller;
+  makecontext(&c->main, c4_start, 0);
+  swapcontext(&c->caller, &c->main); // up to the first instruction, as left is 0
+  if (c->state == C4Done && c->status) { c4_free(c); return 0; } // an error, or main() not defined
+  return c;
+}
+
+int c4_step(c4 *c, int n)
+{
+  if (c->state == C4Ready) {
+    c->left = n - 1; // the instruction main() stopped at is the first one
+    swapcontext(&c->caller, &c->main);
+  }
+  return c->state == C4Done;
+}
+
+int c4_run(c4 *c)
+{
+  while (!c4_step(c, INT_MAX));
+  return c->status;
+}
+
+void c4_free(c4 *c)
+{
+  char *b;
+
+  while (c->nmap--) munmap((void *)c->maps[2 * c->nmap], c->maps[2 * c->nmap + 1]);
+  while ((b = c->heap)) { c->heap = *(char **)b; free(b); }
+  free(c->maps);
+  munmap(c->stack, C4Stack);
+  free(c);
+}
+
+// c4_sched(): the programs not finished wait in a ring, the oldest first; each worker takes one, runs it for a
+// slice and puts it back at the end, until none is left
+struct c4sched {
+  c4 **ring;
+  int n, head, len, left;      // ring size, first and number of programs waiting, programs not finished
+  int slice;
+  pthread_mutex_t lock;
+  pthread_cond_t wait;         // a program was put back, or the last one finished
+};
+
+static void *c4_worker(void *arg)
+{
+  struct c4sched *s = arg;
+  c4 *c;
+
+  pthread_mutex_lock(&s->lock);
+  while (s->left) {
+    if (!s->len) { pthread_cond_wait(&s->wait, &s->lock); continue; } // all are running elsewhere
+    c = s->ring[s->head]; s->head = (s->head + 1) % s->n; --s->len;
+    pthread_mutex_unlock(&s->lock);
+    if (c4_step(c, s->slice)) c = 0;
+    pthread_mutex_lock(&s->lock);
+    if (c) { s->ring[(s->head + s->len++) % s->n] = c; pthread_cond_signal(&s->wait); }
+    else if (!--s->left) pthread_cond_broadcast(&s->wait);
+  }
+  pthread_mutex_unlock(&s->lock);
+  return 0;
+}
+
+int c4_sched(c4 **v, int n, int threads, int slice)
+{
+  struct c4sched s;
+  pthread_t *t;
+  int i;
+
+  if (n < 1) return 0;
+  if (threads < 1 || slice < 1 || !(t = malloc(threads * sizeof(pthread_t)))) return -1;
+  if (!(s.ring = malloc(n * sizeof(c4 *)))) { free(t); return -1; }
+  memcpy(s.ring, v, n * sizeof(c4 *));
+  s.n = s.len = s.left = n; s.head = 0; s.slice = slice;
+  pthread_mutex_init(&s.lock, 0); pthread_cond_init(&s.wait, 0);
+  for (i = 0; i < threads && !pthread_create(t + i, 0, c4_worker, &s); ++i);
+  if (!i) c4_worker(&s); // no thread could be started: run them here
+  while (i) pthread_join(t[--i], 0);
+  pthread_cond_destroy(&s.wait); pthread_mutex_destroy(&s.lock);
+  free(s.ring); free(t);
+  return 0;
+}
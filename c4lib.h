@@ -0,0 +1,4 @@
+// c4lib.h - included into the VM loop of c4.c by c4lib.c: stop when the instructions granted by c4_step() are
+// used up, and before the first one, when the compile is done
+
+    if (--c4t->left < 0) c4_yield();
@@ -0,0 +1,44 @@
+// c4thread.h - included into the VM of c4.c by the C compiler (c4 skips it): -t runs the text as direct threaded code.
+//
+// Before the loop, each opcode up to MOD in the text is replaced by the address of its case in the VM switch, the
+// label that c4label.h puts there. Each case then ends by fetching the next instruction and jumping straight to its
+// case with a computed goto, instead of breaking back to the loop and the switch. The library opcodes and the exit
+// stub on the stack stay opcodes and go through the loop as before. The profile and the trace read the opcodes, and
+// c4lib.c stops the loop between instructions, so with -p, -d or in the library the text is left alone.
+
+#ifndef C4THREAD
+#define C4THREAD
+
+#define C4LABEL_(n) op##n
+#define C4LABEL(n) C4LABEL_(n)
+
+#if __COUNTER__ // the labels are numbered by __COUNTER__: the opcode + 1
+#error "__COUNTER__ is used before c4thread.h"
+#endif
+
+#ifdef C4LIB
+  thread = 0;
+#endif
+  if (thread && !debug && !prof) {
+    static void *c4label[] = {
+      &&op1,  &&op2,  &&op3,  &&op4,  &&op5,  &&op6,  &&op7,  &&op8,  &&op9,  &&op10,
+      &&op11, &&op12, &&op13, &&op14, &&op15, &&op16, &&op17, &&op18, &&op19, &&op20,
+      &&op21, &&op22, &&op23, &&op24, &&op25, &&op26, &&op27, &&op28, &&op29, &&op30,
+      &&op31, &&op32, &&op33, &&op34, &&op35, &&op36, &&op37, &&op38, &&op39, &&op40,
+      &&op41, &&op42, &&op43, &&op44, &&op45, &&op46, &&op47, &&op48, &&op49 };
+    _Static_assert(sizeof(c4label) / sizeof(*c4label) == MOD + 1, "a label for each opcode up to MOD");
+
+    t = text + 1; // the cases of a switch table are instructions too
+    while (t <= e) { i = *t; if (i <= MOD) *t = (int)c4label[i]; t = t + ((i < LEV) ? 2 : 1); }
+  }
+  else thread = 0;
+
+// the end of each case of the VM switch, up to the #undef after it: the next instruction, counted as the loop does
+#define break if (thread) { i = *pc++; ++cycle; if (i > EXIT) goto *(void *)i; goto c4fetched; } break
+
+#else
+
+c4fetched:
+    if (i > EXIT) goto *(void *)i; // an address: threaded
+
+#endif
@@ -1,7 +1,7 @@
 // c4.c - C in four functions
 
 // char, int, and pointer types
-// if, while, return, and expression statements
+// if, while, switch, return, and expression statements
 // just enough features to allow self-compilation and a bit more
 
 // Written by Robert Swierczek
@@ -9,7 +9,10 @@
 // + win32 port by Joe Bogner
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <memory.h>
+#include <string.h>
+#include <stdarg.h>
 
 #ifdef _WIN32
 #define PROT_NONE       0
@@ -29,37 +32,78 @@
 void*   mmap(void *addr, size_t len, int prot, int flags, int fildes, off_t off);
 #else
 #include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 
+#define int intptr_t // a cell holds a pointer: 8 bytes on x86-64
+
 char *p, *lp, // current position in source code
+     **srcs,  // start of each mapped source file
+     **srcv,  // source file names
+     *fname,  // name of the file being parsed
      *jitmem, // executable memory for JIT-compiled native code
      *je,     // current position in emitted native code
+     *jitlim, // end of executable memory, less room for the code of one opcode
+     *dbase,  // start of data area
+     **jitmap, // native address of each bytecode, for the relocation pass
      *data,   // data/bss pointer
-     **linemap; // maps a line number into its source position
+     *dlim,   // end of data area, less room for the data emitted between two tokens
+     **linemap, // maps lbase[file] + line number into its source position
+     *obuf;   // output buffer of the program, see outprintf()
 
 int *e, *le, *text, // current position in emitted code
+    *elim,    // end of text area, less room for the code emitted between two tokens
     *id,      // currently parsed indentifier
     *sym,     // symbol table (simple list of identifiers)
+    *symend,  // first free symbol table entry
+    *symlim,  // end of symbol area
+    *hsym,    // hash index into sym (open addressing)
+    *cas,     // value and address of each case of the switches being parsed
+    *caslim,  // end of case area
+    *swt,     // cases of the innermost switch, from swt + 1 to cas
+    *dft,     // its default
+    *brks,    // breaks out of the innermost switch or loop: their JMPs, chained through the operands up to text
+    hmask,    // hash index size - 1
     tk,       // current token
     ival,     // current token value
     ty,       // current expression type
     loc,      // local variable offset
     line,     // current line number
-    *srcmap,  // maps a bytecode into its corresponding source line number
-    src;      // print source, c4 assembly and JIT addresses
+    fno,      // current source file number
+    nsrc,     // number of source files
+    *lbase,   // linemap index of each source file's line 0; lbase[nsrc] ends the last file
+    *srcmap,  // maps a bytecode into its source file number << 24 | line number
+    *hot,     // call counts at each ENT and loop counts at each JMP of the text, for the interpreter
+    jitsp,    // C stack pointer while the interpreter runs native code
+    perffd,   // -g: perf map of the native code, which is registered with gdb as well
+    *reloc,   // text offsets of the IMMs that load a data address, in text order, 0 terminated
+    *rlp,     // last relocation entry
+    *orel,    // -o: relocations in the native code: address of the field, OPEN..EXIT or -1 for data, data address
+    *orlp,    // last native relocation
+    src,      // print source, c4 assembly and JIT addresses
+    osz,      // size of obuf
+    olen,     // bytes in obuf
+    oline;    // -l: flush obuf at each newline
+
+// gdb's JIT interface: gdb breaks in __jit_debug_register_code() and reads the in-memory object files
+// listed in __jit_debug_descriptor: version 1 in its low 32 bits and the action in the high ones,
+// then the entry that changed and the first one; an entry is next, previous, object address and size
+int __jit_debug_descriptor[3] = { 1, 0, 0 };
+void __attribute__((noinline)) __jit_debug_register_code() { __asm__ volatile ("" ::: "memory"); }
 
 // tokens and classes (operators last and in precedence order)
 enum Token {
   Num = 128, Fun, Sys, Glo, Loc, Id,
-  Char, Else, Enum, If, Int, Return, While,
+  Char, Else, Enum, If, Int, Return, While, Break, Case, Default, Switch,
   Assign, Cond, Lor, Lan, Or, Xor, And, Eq, Ne, Lt, Gt, Le, Ge, Shl, Shr, Add, Sub, Mul, Div, Mod, Inc, Dec, Brak
 };
 
 // opcodes
 enum Opcode {
-  LEA ,IMM ,JMP ,JSR ,BZ  ,BNZ ,ENT ,ADJ ,LEV ,LI  ,LC  ,SI  ,SC  ,PSH ,
+  LEA ,IMM ,JMP ,JSR ,BZ  ,BNZ ,ENT ,ADJ ,TAD ,SWT ,LEV ,LI  ,LC  ,SI  ,SC  ,PSH ,
   OR  ,XOR ,AND ,EQ  ,NE  ,LT  ,GT  ,LE  ,GE  ,SHL ,SHR ,ADD ,SUB ,MUL ,DIV ,MOD ,
-  OPEN,READ,CLOS,PRTF,MALC,MSET,MCMP,EXIT
+  OPEN,READ,CLOS,PRTF,MALC,FREE,MRST,MSET,MCMP,MMAP,MUNM,MCPY,LSEK,WRIT,DPRF,SPRF,EXIT
 };
 
 // types
@@ -71,12 +115,15 @@ enum Identifier { Tk, Hash, Name, Class, Type, Val, HClass, HType, HVal, Idsz };
 next()
 {
   char *pp;
+  int h;
 
+  if (e > elim) { printf("%s:%d: text area exhausted\n", fname, line); exit(-1); }
+  if (data > dlim) { printf("%s:%d: data area exhausted\n", fname, line); exit(-1); }
   while (tk = *p) {
     ++p;
     if (tk == '\n') {
-      linemap[line] = lp; lp = p;
-      while (le < e) { srcmap[le - text] = line; le++; };
+      linemap[lbase[fno] + line] = lp; lp = p;
+      while (le < e) srcmap[++le - text] = fno << 24 | line;
       ++line;
     }
     else if (tk == '#') {
@@ -87,11 +134,24 @@ next()
       while ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9') || *p == '_')
         tk = tk * 147 + *p++;
       tk = (tk << 6) + (p - pp);
-      id = sym;
-      while (id[Tk]) {
+      h = (tk >> 6 ^ tk) & hmask;
+      while (id = (int *)hsym[h]) {
         if (tk == id[Hash] && !memcmp((char *)id[Name], pp, p - pp)) { tk = id[Tk]; return; }
-        id = id + Idsz;
+        h = (h + 1) & hmask;
+      }
+      if (symend >= symlim) { printf("%s:%d: symbol area exhausted\n", fname, line); exit(-1); }
+      if ((symend - sym) * 2 >= (hmask + 1) * Idsz) { // keep the index at most half full: double it and rehash
+        hmask = hmask * 2 + 1;
+        memset(hsym, 0, (hmask + 1) * sizeof(int));
+        for (id = sym; id < symend; id += Idsz) {
+          h = (id[Hash] >> 6 ^ id[Hash]) & hmask;
+          while (hsym[h]) h = (h + 1) & hmask;
+          hsym[h] = (int)id;
+        }
+        h = (tk >> 6 ^ tk) & hmask;
+        while (hsym[h]) h = (h + 1) & hmask;
       }
+      hsym[h] = (int)(id = symend); symend = symend + Idsz;
       id[Name] = (int)pp;
       id[Hash] = tk;
       tk = id[Tk] = Id;
@@ -119,7 +179,10 @@ next()
         if ((ival = *p++) == '\\') {
           if ((ival = *p++) == 'n') ival = '\n';
         }
-        if (tk == '"') *data++ = ival;
+        if (tk == '"') {
+          if (data >= dlim) { printf("%s:%d: data area exhausted\n", fname, line); exit(-1); }
+          *data++ = ival;
+        }
       }
       ++p;
       if (tk == '"') ival = (int)pp; else tk = Num;
@@ -140,18 +203,26 @@ next()
     else if (tk == '?') { tk = Cond; return; }
     else if (tk == '~' || tk == ';' || tk == '{' || tk == '}' || tk == '(' || tk == ')' || tk == ']' || tk == ',' || tk == ':') return;
   }
+  if (fno < nsrc - 1) { // end of this file: carry on with the next one of the translation unit
+    linemap[lbase[fno] + line] = lp;
+    while (le < e) srcmap[++le - text] = fno << 24 | line;
+    lbase[fno + 1] = lbase[fno] + line + 1;
+    lp = p = srcs[++fno]; fname = srcv[fno]; line = 1;
+    next();
+  }
 }
 
 expr(int lev)
 {
-  int t, *d;
+  int t, *d, *b;
 
-  if (!tk) { printf("%d: unexpected eof in expression\n", line); exit(-1); }
+  b = e; // the code of this expression starts at b + 1: when that is just "IMM n", it is a constant
+  if (!tk) { printf("%s:%d: unexpected eof in expression\n", fname, line); exit(-1); }
   else if (tk == Num) { *++e = IMM; *++e = ival; next(); ty = TYINT; }
   else if (tk == '"') {
-    *++e = IMM; *++e = ival; next();
+    *++e = IMM; *++rlp = e - text; *++e = ival; next();
     while (tk == '"') next();
-    data = (char *)((int)data + 4 & -4); ty = PTR;
+    data = (char *)((int)data + sizeof(int) & -sizeof(int)); ty = PTR;
   }
   else if (tk == Id) {
     d = id; next();
@@ -162,15 +233,15 @@ expr(int lev)
       next();
       if (d[Class] == Sys) *++e = d[Val];
       else if (d[Class] == Fun) { *++e = JSR; *++e = d[Val]; }
-      else { printf("%d: bad function call\n", line); exit(-1); }
+      else { printf("%s:%d: bad function call\n", fname, line); exit(-1); }
       if (t) { *++e = ADJ; *++e = t; }
       ty = d[Type];
     }
     else if (d[Class] == Num) { *++e = IMM; *++e = d[Val]; ty = TYINT; }
     else {
       if (d[Class] == Loc) { *++e = LEA; *++e = loc - d[Val]; }
-      else if (d[Class] == Glo) { *++e = IMM; *++e = d[Val]; }
-      else { printf("%d: undefined variable\n", line); exit(-1); }
+      else if (d[Class] == Glo) { *++e = IMM; *++rlp = e - text; *++e = d[Val]; }
+      else { printf("%s:%d: undefined variable\n", fname, line); exit(-1); }
       *++e = ((ty = d[Type]) == TYCHAR) ? LC : LI;
     }
   }
@@ -179,57 +250,65 @@ expr(int lev)
     if (tk == Int || tk == Char) {
       t = (tk == Int) ? TYINT : TYCHAR; next();
       while (tk == Mul) { next(); t = t + PTR; }
-      if (tk == ')') next(); else { printf("%d: bad cast\n", line); exit(-1); }
+      if (tk == ')') next(); else { printf("%s:%d: bad cast\n", fname, line); exit(-1); }
       expr(Inc);
       ty = t;
     }
     else {
       expr(Assign);
-      if (tk == ')') next(); else { printf("%d: close paren expected\n", line); exit(-1); }
+      if (tk == ')') next(); else { printf("%s:%d: close paren expected\n", fname, line); exit(-1); }
     }
   }
   else if (tk == Mul) {
     next(); expr(Inc);
-    if (ty > TYINT) ty = ty - PTR; else { printf("%d: bad dereference\n", line); exit(-1); }
+    if (ty > TYINT) ty = ty - PTR; else { printf("%s:%d: bad dereference\n", fname, line); exit(-1); }
     *++e = (ty == TYCHAR) ? LC : LI;
   }
   else if (tk == And) {
     next(); expr(Inc);
-    if (*e == LC || *e == LI) --e; else { printf("%d: bad address-of\n", line); exit(-1); }
+    if (*e == LC || *e == LI) --e; else { printf("%s:%d: bad address-of\n", fname, line); exit(-1); }
     ty = ty + PTR;
   }
-  else if (tk == '!') { next(); expr(Inc); *++e = PSH; *++e = IMM; *++e = 0; *++e = EQ; ty = TYINT; }
-  else if (tk == '~') { next(); expr(Inc); *++e = PSH; *++e = IMM; *++e = -1; *++e = XOR; ty = TYINT; }
+  else if (tk == '!') { // unary operators on a constant are folded; data addresses (in reloc) are left alone
+    next(); expr(Inc);
+    if (e == b + 2 && b[1] == IMM && *rlp <= b - text) b[2] = !b[2]; else { *++e = PSH; *++e = IMM; *++e = 0; *++e = EQ; }
+    ty = TYINT;
+  }
+  else if (tk == '~') {
+    next(); expr(Inc);
+    if (e == b + 2 && b[1] == IMM && *rlp <= b - text) b[2] = ~b[2]; else { *++e = PSH; *++e = IMM; *++e = -1; *++e = XOR; }
+    ty = TYINT;
+  }
   else if (tk == Add) { next(); expr(Inc); ty = TYINT; }
   else if (tk == Sub) {
-    next(); *++e = IMM;
-    if (tk == Num) { *++e = -ival; next(); } else { *++e = -1; *++e = PSH; expr(Inc); *++e = MUL; }
+    next(); expr(Inc);
+    if (e == b + 2 && b[1] == IMM && *rlp <= b - text) b[2] = -b[2]; else { *++e = PSH; *++e = IMM; *++e = -1; *++e = MUL; }
     ty = TYINT;
   }
   else if (tk == Inc || tk == Dec) {
     t = tk; next(); expr(Inc);
     if (*e == LC) { *e = PSH; *++e = LC; }
     else if (*e == LI) { *e = PSH; *++e = LI; }
-    else { printf("%d: bad lvalue in pre-increment\n", line); exit(-1); }
+    else { printf("%s:%d: bad lvalue in pre-increment\n", fname, line); exit(-1); }
     *++e = PSH;
-    *++e = IMM; *++e = (ty > PTR) ? 4 : 1;
+    *++e = IMM; *++e = (ty > PTR) ? sizeof(int) : 1;
     *++e = (t == Inc) ? ADD : SUB;
     *++e = (ty == TYCHAR) ? SC : SI;
   }
-  else { printf("%d: bad expression\n", line); exit(-1); }
+  else { printf("%s:%d: bad expression\n", fname, line); exit(-1); }
 
   while (tk >= lev) { // "precedence climbing" or "Top Down Operator Precedence" method
     t = ty;
     if (tk == Assign) {
       next();
-      if (*e == LC || *e == LI) *e = PSH; else { printf("%d: bad lvalue in assignment\n", line); exit(-1); }
+      if (*e == LC || *e == LI) *e = PSH; else { printf("%s:%d: bad lvalue in assignment\n", fname, line); exit(-1); }
       expr(Assign); *++e = ((ty = t) == TYCHAR) ? SC : SI;
     }
     else if (tk == Cond) {
       next();
       *++e = BZ; d = ++e;
       expr(Assign);
-      if (tk == ':') next(); else { printf("%d: conditional missing colon\n", line); exit(-1); }
+      if (tk == ':') next(); else { printf("%s:%d: conditional missing colon\n", fname, line); exit(-1); }
       *d = (int)(e + 3); *++e = JMP; d = ++e;
       expr(Cond);
       *d = (int)(e + 1);
@@ -247,51 +326,90 @@ expr(int lev)
     else if (tk == Ge)  { next(); *++e = PSH; expr(Shl); *++e = GE;  ty = TYINT; }
     else if (tk == Shl) { next(); *++e = PSH; expr(Add); *++e = SHL; ty = TYINT; }
     else if (tk == Shr) { next(); *++e = PSH; expr(Add); *++e = SHR; ty = TYINT; }
-    else if (tk == Add) {
-      next(); *++e = PSH; expr(Mul);
-      if ((ty = t) > PTR) { *++e = PSH; *++e = IMM; *++e = 4; *++e = MUL;  }
+    else if (tk == Add) { // an int added to a pointer is scaled by a shift (8 == 1 << 3), or right away when it is a constant
+      next(); *++e = PSH; d = e; expr(Mul);
+      if ((ty = t) > PTR) {
+        if (e == d + 2 && d[1] == IMM && *rlp <= d - text) d[2] = d[2] * sizeof(int); else { *++e = PSH; *++e = IMM; *++e = 3; *++e = SHL; }
+      }
       *++e = ADD;
     }
     else if (tk == Sub) {
-      next(); *++e = PSH; expr(Mul);
-      if ((ty = t) > PTR) { *++e = PSH; *++e = IMM; *++e = 4; *++e = MUL;  }
-      *++e = SUB;
+      next(); *++e = PSH; d = e; expr(Mul);
+      if (t > PTR && t == ty) { *++e = SUB; *++e = PSH; *++e = IMM; *++e = 3; *++e = SHR; ty = TYINT; } // pointer difference, exact
+      else {
+        if ((ty = t) > PTR) {
+          if (e == d + 2 && d[1] == IMM && *rlp <= d - text) d[2] = d[2] * sizeof(int); else { *++e = PSH; *++e = IMM; *++e = 3; *++e = SHL; }
+        }
+        *++e = SUB;
+      }
+    }
+    else if (tk == Mul) {
+      next(); *++e = PSH; d = e; expr(Inc); *++e = MUL; ty = TYINT;
+      if (e == d + 3 && d[1] == IMM && *rlp <= d - text && d[2] > 1 && !(d[2] & (d[2] - 1))) { // by a power of two: shift
+        t = 0; while ((int)1 << t < d[2]) ++t; // in cell width: the constant may not fit in 32 bits
+        d[2] = t; *e = SHL;
+      }
     }
-    else if (tk == Mul) { next(); *++e = PSH; expr(Inc); *++e = MUL; ty = TYINT; }
     else if (tk == Div) { next(); *++e = PSH; expr(Inc); *++e = DIV; ty = TYINT; }
     else if (tk == Mod) { next(); *++e = PSH; expr(Inc); *++e = MOD; ty = TYINT; }
     else if (tk == Inc || tk == Dec) {
       if (*e == LC) { *e = PSH; *++e = LC; }
       else if (*e == LI) { *e = PSH; *++e = LI; }
-      else { printf("%d: bad lvalue in post-increment\n", line); exit(-1); }
-      *++e = PSH; *++e = IMM; *++e = (ty > PTR) ? 4 : 1;
+      else { printf("%s:%d: bad lvalue in post-increment\n", fname, line); exit(-1); }
+      *++e = PSH; *++e = IMM; *++e = (ty > PTR) ? sizeof(int) : 1;
       *++e = (tk == Inc) ? ADD : SUB;
       *++e = (ty == TYCHAR) ? SC : SI;
-      *++e = PSH; *++e = IMM; *++e = (ty > PTR) ? 4 : 1;
+      *++e = PSH; *++e = IMM; *++e = (ty > PTR) ? sizeof(int) : 1;
       *++e = (tk == Inc) ? SUB : ADD;
       next();
     }
     else if (tk == Brak) {
-      next(); *++e = PSH; expr(Assign);
-      if (tk == ']') next(); else { printf("%d: close bracket expected\n", line); exit(-1); }
-      if (t > PTR) { *++e = PSH; *++e = IMM; *++e = 4; *++e = MUL;  }
-      else if (t < PTR) { printf("%d: pointer type expected\n", line); exit(-1); }
+      next(); *++e = PSH; d = e; expr(Assign);
+      if (tk == ']') next(); else { printf("%s:%d: close bracket expected\n", fname, line); exit(-1); }
+      if (t > PTR) {
+        if (e == d + 2 && d[1] == IMM && *rlp <= d - text) d[2] = d[2] * sizeof(int); else { *++e = PSH; *++e = IMM; *++e = 3; *++e = SHL; }
+      }
+      else if (t < PTR) { printf("%s:%d: pointer type expected\n", fname, line); exit(-1); }
       *++e = ADD;
       *++e = ((ty = t - PTR) == TYCHAR) ? LC : LI;
     }
-    else { printf("%d: compiler error tk=%d\n", line, tk); exit(-1); }
+    else { printf("%s:%d: compiler error tk=%d\n", fname, line, tk); exit(-1); }
+
+    // "IMM x; PSH; IMM y; op" with no data address: fold it into "IMM x op y" (but leave division by zero,
+    // and by -1, which traps on the lowest value, to run time)
+    if (e == b + 6 && b[1] == IMM && b[3] == PSH && b[4] == IMM && *e >= OR && *e <= MOD && *rlp <= b - text
+        && !(*e >= DIV && (!b[5] || b[5] == -1))) {
+      t = b[5]; d = b + 2;
+      if      (*e == OR)  *d = *d |  t;
+      else if (*e == XOR) *d = *d ^  t;
+      else if (*e == AND) *d = *d &  t;
+      else if (*e == EQ)  *d = *d == t;
+      else if (*e == NE)  *d = *d != t;
+      else if (*e == LT)  *d = *d <  t;
+      else if (*e == GT)  *d = *d >  t;
+      else if (*e == LE)  *d = *d <= t;
+      else if (*e == GE)  *d = *d >= t;
+      else if (*e == SHL) *d = *d << t;
+      else if (*e == SHR) *d = *d >> t;
+      else if (*e == ADD) *d = *d +  t;
+      else if (*e == SUB) *d = *d -  t;
+      else if (*e == MUL) *d = *d *  t;
+      else if (*e == DIV) *d = *d /  t;
+      else                *d = *d %  t;
+      e = d; if (le > e) le = e;
+    }
   }
 }
 
 stmt()
 {
-  int *a, *b;
+  int *a, *b, *c, *d, *f, i, j;
 
   if (tk == If) {
     next();
-    if (tk == '(') next(); else { printf("%d: open paren expected\n", line); exit(-1); }
+    if (tk == '(') next(); else { printf("%s:%d: open paren expected\n", fname, line); exit(-1); }
     expr(Assign);
-    if (tk == ')') next(); else { printf("%d: close paren expected\n", line); exit(-1); }
+    if (tk == ')') next(); else { printf("%s:%d: close paren expected\n", fname, line); exit(-1); }
     *++e = BZ; b = ++e;
     stmt();
     if (tk == Else) {
@@ -304,19 +422,92 @@ stmt()
   else if (tk == While) {
     next();
     a = e + 1;
-    if (tk == '(') next(); else { printf("%d: open paren expected\n", line); exit(-1); }
+    if (tk == '(') next(); else { printf("%s:%d: open paren expected\n", fname, line); exit(-1); }
     expr(Assign);
-    if (tk == ')') next(); else { printf("%d: close paren expected\n", line); exit(-1); }
+    if (tk == ')') next(); else { printf("%s:%d: close paren expected\n", fname, line); exit(-1); }
     *++e = BZ; b = ++e;
+    f = brks; brks = text;
     stmt();
     *++e = JMP; *++e = (int)a;
     *b = (int)(e + 1);
+    while (brks != text) { a = (int *)*brks; *brks = (int)(e + 1); brks = a; }
+    brks = f;
+  }
+  else if (tk == Switch) {
+    next();
+    if (tk == '(') next(); else { printf("%s:%d: open paren expected\n", fname, line); exit(-1); }
+    expr(Assign);
+    if (tk == ')') next(); else { printf("%s:%d: close paren expected\n", fname, line); exit(-1); }
+    *++e = JMP; b = ++e; // to the dispatch, after the body
+    c = swt; d = dft; f = brks; swt = cas; dft = 0; brks = text;
+    stmt();
+    *++e = JMP; *++e = (int)brks; brks = e;
+    *b = (int)(e + 1);
+    a = swt + 3;
+    while (a < cas) { // sort the cases by value
+      b = a; i = *a; j = a[1];
+      while (b > swt + 1 && b[-2] >= i) {
+        if (b[-2] == i) { printf("%s:%d: duplicate case %d\n", fname, line, i); exit(-1); }
+        *b = b[-2]; b[1] = b[-1]; b = b - 2;
+      }
+      *b = i; b[1] = j; a = a + 2;
+    }
+    // SWT n: n cases "IMM value; JMP target" by value and the JMP to the default. The VM bisects them, or indexes
+    // them when their values are consecutive: dense cases, spanning less than twice their number, get the holes filled in
+    *++e = SWT; *++e = (cas - swt) / 2; a = swt + 1;
+    i = *e > 1 && cas[-1] - *a >= 0 && cas[-1] - *a < 2 * *e;
+    if (i) *e = cas[-1] - *a + 1;
+    if (e + 4 * *e + 2 > elim) { printf("%s:%d: text area exhausted\n", fname, line); exit(-1); }
+    j = *a;
+    while (a < cas) {
+      *++e = IMM; *++e = j; *++e = JMP;
+      if (*a == j) { *++e = a[1]; a = a + 2; } else if (dft) *++e = (int)dft; else { *++e = (int)brks; brks = e; }
+      j = i ? j + 1 : *a;
+    }
+    *++e = JMP; if (dft) *++e = (int)dft; else { *++e = (int)brks; brks = e; }
+    while (brks != text) { a = (int *)*brks; *brks = (int)(e + 1); brks = a; }
+    cas = swt; swt = c; dft = d; brks = f;
+  }
+  else if (tk == Case) {
+    next();
+    if (!swt) { printf("%s:%d: case outside of switch\n", fname, line); exit(-1); }
+    b = e; expr(Cond);
+    if (e != b + 2 || b[1] != IMM || *rlp > b - text) { printf("%s:%d: bad case constant\n", fname, line); exit(-1); }
+    if (cas >= caslim) { printf("%s:%d: case area exhausted\n", fname, line); exit(-1); }
+    *++cas = b[2]; *++cas = (int)(b + 1); e = b; if (le > e) le = e;
+    if (tk == ':') next(); else { printf("%s:%d: colon expected\n", fname, line); exit(-1); }
+    stmt();
+  }
+  else if (tk == Default) {
+    next();
+    if (!swt) { printf("%s:%d: default outside of switch\n", fname, line); exit(-1); }
+    if (dft) { printf("%s:%d: duplicate default\n", fname, line); exit(-1); }
+    dft = e + 1;
+    if (tk == ':') next(); else { printf("%s:%d: colon expected\n", fname, line); exit(-1); }
+    stmt();
+  }
+  else if (tk == Break) {
+    next();
+    if (!brks) { printf("%s:%d: break outside of switch or loop\n", fname, line); exit(-1); }
+    *++e = JMP; *++e = (int)brks; brks = e;
+    if (tk == ';') next(); else { printf("%s:%d: semicolon expected\n", fname, line); exit(-1); }
   }
   else if (tk == Return) {
     next();
-    if (tk != ';') expr(Assign);
+    if (tk != ';') {
+      b = e; expr(Assign);
+      // return f(...), when f takes no more arguments than this function: TAD moves them over ours and
+      // drops this frame, then f is jumped to, so that its frame takes the place of this one
+      a = b + 1; c = d = 0;
+      while (a <= e) { // find the last two instructions; nothing may branch to the LEV after them
+        if ((*a == JMP || *a == BZ || *a == BNZ) && a[1] == (int)(e + 1)) b = 0;
+        c = d; d = a; a = a + ((*a < LEV) ? 2 : 1);
+      }
+      if (b && d && *d == JSR) { a = (int *)d[1]; *d = TAD; d[1] = 0; *++e = JMP; *++e = (int)a; }
+      else if (b && c && *c == JSR && *d == ADJ && d[1] < loc) { a = (int *)c[1]; *c = TAD; c[1] = d[1]; *d = JMP; d[1] = (int)a; }
+    }
     *++e = LEV;
-    if (tk == ';') next(); else { printf("%d: semicolon expected\n", line); exit(-1); }
+    if (tk == ';') next(); else { printf("%s:%d: semicolon expected\n", fname, line); exit(-1); }
   }
   else if (tk == '{') {
     next();
@@ -328,46 +519,574 @@ stmt()
   }
   else {
     expr(Assign);
-    if (tk == ';') next(); else { printf("%d: semicolon expected\n", line); exit(-1); }
+    if (tk == ';') next(); else { printf("%s:%d: semicolon expected\n", fname, line); exit(-1); }
+  }
+}
+
+// the program's output to stdout is collected in obuf and written out when it is full, before reading stdin,
+// at exit, and with -l at each newline; what c4x86 printed itself through stdio goes first
+void outflush()
+{
+  int k, n;
+
+  fflush(stdout);
+  for (k = 0; k < olen && (n = write(1, obuf + k, olen - k)) > 0; k += n);
+  olen = 0;
+}
+
+int outprintf(char *fmt, ...)
+{
+  va_list ap; int n;
+
+  va_start(ap, fmt); n = vsnprintf(obuf + olen, osz - olen, fmt, ap); va_end(ap);
+  if (n >= osz - olen && olen) { outflush(); va_start(ap, fmt); n = vsnprintf(obuf, osz, fmt, ap); va_end(ap); }
+  if (n >= osz) { va_start(ap, fmt); n = vdprintf(1, fmt, ap); va_end(ap); } // longer than the buffer
+  else if (n > 0) { olen += n; if (oline && memchr(obuf + olen - n, '\n', n)) outflush(); }
+  return n;
+}
+
+int outwrite(int fd, char *b, int n)
+{
+  if (fd != 1 || n < 0) return write(fd, b, n);
+  if (olen + n > osz && olen) outflush();
+  if (n >= osz) return write(1, b, n);
+  memcpy(obuf + olen, b, n); olen += n;
+  if (oline && memchr(b, '\n', n)) outflush();
+  return n;
+}
+
+int outdprintf(int fd, char *fmt, ...)
+{
+  va_list ap; int n;
+
+  if (fd == 1) outflush();
+  va_start(ap, fmt); n = vdprintf(fd, fmt, ap); va_end(ap);
+  return n;
+}
+
+int outread(int fd, char *b, int n)
+{
+  if (!fd) outflush();
+  return read(fd, b, n);
+}
+
+// malloc() of the program, as in c4: a block of a size class of whole words comes from the free list of its class or
+// else from the arena, with a bump pointer; larger ones are mapped on their own. The word before a block holds its class,
+// or for a large one its size in words, after the previous and next large blocks
+enum { MCls = 28, MArenaSz = 4 * 1024 * 1024 };
+int *mfree[MCls + 1], *mbig; char *mbump, *mlim, *marena;
+
+int *memalloc(int n)
+{
+  int w, c, *b;
+
+  if (n < 0 || n > (int)1 << 62) return 0; // more than a quarter of the address space never maps, and would overflow below
+  w = n ? (n + 7) >> 3 : 1; c = w;
+  if (w > 16) { for (c = 17; c <= MCls && 16 << (c - 16) < w; ++c); if (c <= MCls) w = 16 << (c - 16); }
+  if (c > MCls) {
+    if ((b = mmap(0, (w + 3) * 8, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0)) == MAP_FAILED) return 0;
+    if ((b[1] = (int)mbig)) *mbig = (int)b;
+    mbig = b; b[2] = w;
+    return b + 3;
+  }
+  if ((b = mfree[c])) { mfree[c] = (int *)*b; return b; }
+  if (mbump + (w + 1) * 8 > mlim) { // a new arena, linked through its first word
+    if ((b = mmap(0, MArenaSz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0)) == MAP_FAILED) return 0;
+    *b = (int)marena; marena = (char *)b; mbump = (char *)(b + 1); mlim = marena + MArenaSz;
+  }
+  b = (int *)mbump; mbump += (w + 1) * 8; *b = c;
+  return b + 1;
+}
+
+void memfree(int *b)
+{
+  if (!b) return;
+  if (b[-1] <= MCls) { *b = (int)mfree[b[-1]]; mfree[b[-1]] = b; return; }
+  b -= 3;
+  if (*b) ((int *)*b)[1] = b[1]; else mbig = (int *)b[1];
+  if (b[1]) *(int *)b[1] = *b;
+  munmap(b, (b[2] + 3) * 8);
+}
+
+void memreset() // mreset(): free every block; only the current arena stays mapped, and starts over
+{
+  char *a;
+
+  while (mbig) { a = (char *)mbig; mbig = (int *)mbig[1]; munmap(a, (((int *)a)[2] + 3) * 8); }
+  if (marena) {
+    while ((a = *(char **)marena)) { *(char **)marena = *(char **)a; munmap(a, MArenaSz); }
+    mbump = marena + 8;
+  }
+  memset(mfree, 0, sizeof(mfree));
+}
+
+// the library: the native function of each builtin, in the order of the opcodes from OPEN on, called by the interpreter
+// and the compiled code alike, and whether it returns a 32 bit int, to be sign extended; main() names them for c4
+void *lib[] = { open, outread, close, outprintf, memalloc, memfree, memreset, memset, memcmp, mmap, munmap, memcpy, lseek, outwrite,
+                outdprintf, snprintf, exit };
+char lib32[] = { 1, 0, 1, 0, 0, 0, 0, 0, 1, 0, 1, 0, 0, 0, 0, 1, 0 };
+
+// emit a 64 bit register to register instruction "op reg, rm"; registers are numbered as in ModRM, r8 and up set REX bits
+rr(int op, int reg, int rm)
+{
+  *je++ = 0x48 | (reg >> 3) << 2 | rm >> 3;
+  if (op > 0xff) *je++ = op >> 8;
+  *je++ = op; *je++ = 0xc0 | (reg & 7) << 3 | (rm & 7);
+}
+
+// the native code of a bisection of the cases lo .. hi - 1 of the SWT table at t on %rax: the JMPs of its
+// n cases are compiled into a jmp <off32> each from s on, and that to the default follows them
+jitcases(int *t, int lo, int hi, char *s, int n)
+{
+  int m, v; char *l;
+
+  if (lo == hi) { *je = 0xe9; *(int32_t *)(je + 1) = s + 5 * n - (je + 5); je += 5; return; }   // jmp <default>
+  m = (lo + hi) / 2; v = t[4 * m + 1];
+  if (v == (int32_t)v) { memcpy(je, "\x48\x3d", 2); *(int32_t *)(je + 2) = v; je += 6; }         // cmp $imm32, %rax
+  else { memcpy(je, "\x48\xb9", 2); *(int64_t *)(je + 2) = v; memcpy(je + 10, "\x48\x39\xc8", 3); je += 13; } // movabs $imm64, %rcx; cmp %rcx, %rax
+  memcpy(je, "\x0f\x84", 2); *(int32_t *)(je + 2) = s + 5 * m - (je + 6); je += 6;                 // je <case m>
+  memcpy(je, "\x0f\x8c", 2); l = je + 2; je += 6;                                                      // jl <lower half>
+  jitcases(t, m + 1, hi, s, n);
+  *(int32_t *)l = je - (l + 4);
+  jitcases(t, lo, m, s, n);
+}
+
+// ELF header of a 64 bit x86-64 relocatable object with shnum section headers, shstrndx the section names
+elfhdr(char *b, int shnum, int shstrndx)
+{
+  memset(b, 0, 64);
+  memcpy(b, "\x7f" "ELF\2\1\1", 7);                 // 64 bit, little endian
+  *(int16_t *)(b + 16) = 1; *(int16_t *)(b + 18) = 62; // ET_REL, EM_X86_64
+  *(int32_t *)(b + 20) = 1; *(int16_t *)(b + 52) = 64; // version, header size
+  *(int16_t *)(b + 58) = 64; *(int16_t *)(b + 60) = shnum; *(int16_t *)(b + 62) = shstrndx;
+}
+
+// append an ELF section header to o
+char *elfsh(char *o, int name, int type, int flags, int addr, int off, int size, int link, int info, int align, int entsize)
+{
+  *(int32_t *)o = name; *(int32_t *)(o + 4) = type; *(int64_t *)(o + 8) = flags; *(int64_t *)(o + 16) = addr;
+  *(int64_t *)(o + 24) = off; *(int64_t *)(o + 32) = size; *(int32_t *)(o + 40) = link; *(int32_t *)(o + 44) = info;
+  *(int64_t *)(o + 48) = align; *(int64_t *)(o + 56) = entsize;
+  return o + 64;
+}
+
+// append v to o in LEB128, signed, which reads the same unsigned for v >= 0
+char *leb(char *o, int v)
+{
+  while (v < -64 || v > 63) { *o++ = (v & 127) | 128; v = v >> 7; }
+  *o++ = v & 127;
+  return o;
+}
+
+// -g: name the native code of the function f, from start to je, for perf and register an ELF object for
+// gdb with its symbol and a DWARF line table from srcmap
+jitdebug(int *f, int *end, char *start)
+{
+  int *pc, n, ln, fl;
+  char *b, *o, *name, *sh, *str, *symtab, *info, *abbrev, *lines, *prog;
+
+  name = "?"; n = 1;
+  for (id = sym; id < symend; id += Idsz)
+    if (id[Class] == Fun && (int *)id[Val] == f) { name = (char *)id[Name]; n = id[Hash] & 63; }
+  dprintf(perffd, "%lx %lx %.*s\n", start, je - start, n, name);
+
+  for (ln = fl = 0; fl < nsrc; ++fl) ln += strlen(srcv[fl]) + 4; // the file table, which names the compile unit once more
+  if (!(b = o = malloc(1024 + n + 2 * ln + (end - f) * 16))) { printf("could not malloc jit debug object\n"); exit(-1); }
+  elfhdr(b, 8, 2);
+  o += 64;
+  sh = o; memcpy(o, "\0.text\0.shstrtab\0.strtab\0.symtab\0.debug_info\0.debug_abbrev\0.debug_line", 71); o += 71;
+  str = o; *o++ = 0; memcpy(o, name, n); o += n; *o++ = 0;
+  o = (char *)((int)(o + 7) & -8);
+  symtab = o; memset(o, 0, 48); // the null symbol, then the function: global, code, in .text
+  *(int32_t *)(o + 24) = 1; o[28] = 18; *(int16_t *)(o + 30) = 1; *(int64_t *)(o + 40) = je - start; o += 48;
+
+  // one compile unit with the function's address range and its line table
+  info = o; memset(o, 0, 11);
+  *(int16_t *)(o + 4) = 2; o[10] = 8; o += 11; // version 2, abbreviations at 0, 8 byte addresses
+  *o++ = 1; fl = srcmap[f - text] >> 24; n = strlen(srcv[fl]) + 1; memcpy(o, srcv[fl], n); o += n;
+  *(int32_t *)o = 0; *(int64_t *)(o + 4) = (int)start; *(int64_t *)(o + 12) = (int)je; o += 20;
+  *(int32_t *)info = o - info - 4;
+  abbrev = o; // 1: compile unit, no children, name string, stmt_list data4, low_pc addr, high_pc addr
+  memcpy(o, "\1\21\0\3\10\20\6\21\1\22\1\0\0\0", 14); o += 14;
+  lines = o;
+  *(int16_t *)(o + 4) = 2; o += 10; // version 2, then header length
+  memcpy(o, "\1\1\373\16\15\0\1\1\1\1\0\0\0\1\0\0\1\0", 18); o += 18; // min insn 1, is_stmt, line base -5, range 14,
+                                                                         // 13 opcodes and their lengths; no directories
+  for (n = 0; n < nsrc; ++n) { ln = strlen(srcv[n]) + 1; memcpy(o, srcv[n], ln); o += ln; *o++ = 0; *o++ = 0; *o++ = 0; } // file n + 1
+  *o++ = 0;
+  *(int32_t *)(lines + 6) = o - lines - 10;
+  prog = start; fl = 1; ln = 1;
+  memcpy(o, "\0\11\2", 3); *(int64_t *)(o + 3) = (int)start; o += 11; // DW_LNE_set_address
+  for (pc = f; pc < end; pc += (*pc < LEV) ? 2 : 1) {
+    n = srcmap[pc - text];
+    if ((n >> 24) + 1 != fl || (n & 16777215) != ln) {
+      if ((n >> 24) + 1 != fl) { *o++ = 4; fl = (n >> 24) + 1; o = leb(o, fl); }          // DW_LNS_set_file
+      if ((n & 16777215) != ln) { *o++ = 3; o = leb(o, (n & 16777215) - ln); ln = n & 16777215; } // DW_LNS_advance_line
+      if (jitmap[pc - text] != prog) { *o++ = 2; o = leb(o, jitmap[pc - text] - prog); prog = jitmap[pc - text]; } // DW_LNS_advance_pc
+      *o++ = 1;                                                                            // DW_LNS_copy
+    }
+  }
+  *o++ = 2; o = leb(o, je - prog); memcpy(o, "\0\1\1", 3); o += 3; // DW_LNE_end_sequence
+  *(int32_t *)lines = o - lines - 4;
+
+  // section headers: null, .text (only its address: the code is in jitmem), .shstrtab, .strtab,
+  // .symtab, .debug_info, .debug_abbrev, .debug_line
+  o = (char *)((int)(o + 7) & -8);
+  *(int64_t *)(b + 40) = o - b; memset(o, 0, 64); o += 64;
+  o = elfsh(o, 1, 8, 6, (int)start, 64, je - start, 0, 0, 16, 0);              // NOBITS, alloc + exec
+  o = elfsh(o, 7, 3, 0, 0, sh - b, 71, 0, 0, 1, 0);
+  o = elfsh(o, 17, 3, 0, 0, str - b, symtab - str, 0, 0, 1, 0);
+  o = elfsh(o, 25, 2, 0, 0, symtab - b, 48, 3, 1, 8, 24);                      // names in .strtab, 1 local
+  o = elfsh(o, 33, 1, 0, 0, info - b, abbrev - info, 0, 0, 1, 0);
+  o = elfsh(o, 45, 1, 0, 0, abbrev - b, lines - abbrev, 0, 0, 1, 0);
+  o = elfsh(o, 59, 1, 0, 0, lines - b, *(int32_t *)lines + 4, 0, 0, 1, 0);
+
+  // link it in front of the list and tell gdb
+  pc = malloc(4 * sizeof(int));
+  pc[0] = __jit_debug_descriptor[2]; pc[1] = 0; pc[2] = (int)b; pc[3] = o - b;
+  if (pc[0]) ((int *)pc[0])[1] = (int)pc;
+  __jit_debug_descriptor[1] = __jit_debug_descriptor[2] = (int)pc;
+  __jit_debug_descriptor[0] = 1 | (int)1 << 32; // JIT_REGISTER_FN
+  __jit_debug_register_code();
+}
+
+// compile the function at pc, from its ENT up to the next one, into native code at je
+int *jitcode(int *pc)
+{
+  int *f, i, n, k, tmp; // temps
+  int cd, r, s, m, j; // operand stack entries cached in registers, cache register, native call argument moves
+
+  f = pc; cd = 0;
+  while (pc <= e && (pc == f || *pc != ENT)) {
+    i = *pc;
+    if (src) {
+        while ((fno << 24 | line) < srcmap[pc - text]) {
+            if (lbase[fno] + line + 1 == lbase[fno + 1]) { line = 0; printf("%s:\n", srcv[++fno]); continue; }
+            lp = linemap[lbase[fno] + ++line];
+            printf("% 4d | %.*s\n", line, (int)strcspn(lp, "\n"), lp);
+        }
+        printf("0x%05x (%p):\t%8.4s", pc - text, je,
+                        &"LEA ,IMM ,JMP ,JSR ,BZ  ,BNZ ,ENT ,ADJ ,TAD ,SWT ,LEV ,LI  ,LC  ,SI  ,SC  ,PSH ,"
+                         "OR  ,XOR ,AND ,EQ  ,NE  ,LT  ,GT  ,LE  ,GE  ,SHL ,SHR ,ADD ,SUB ,MUL ,DIV ,MOD ,"
+                         "OPEN,READ,CLOS,PRTF,MALC,FREE,MRST,MSET,MCMP,MMAP,MUNM,MCPY,LSEK,WRIT,DPRF,SPRF,EXIT,"[i * 5]);
+        if (i < LEV) printf(" 0x%lx\n", *(pc + 1)); else printf("\n");
+    }
+    if (je > jitlim) { printf("jit: executable memory exhausted\n"); exit(-1); }
+    // the top cd entries of the c4 stack live in %rdi, %rsi, %r8, %r9 (the top one last) instead of being
+    // pushed; push them where the real stack is read or control flow may join, and when all four are taken
+    if (cd && (jitmap[pc - text] || i == JMP || i == JSR || i == BZ || i == BNZ || i == ADJ || i == TAD || i == SWT || (i == PSH && cd == 4) ||
+               (i >= OPEN && pc[1] == ADJ && pc[2] > 6))) {
+      for (k = 0; k < cd; ++k) { r = "\7\6\10\11"[k]; if (r > 7) *je++ = 0x41; *je++ = 0x50 | (r & 7); } // push %reg
+      cd = 0;
+    }
+    jitmap[pc++ - text] = je; // for later relocation of JMP/JSR/BZ/BNZ
+    if (cd && (i == SI || i == SC || (OR <= i && i <= MOD))) { // binary operator with a cached left operand
+      r = "\7\6\10\11"[--cd];
+      if      (i == SI)  { *je++ = 0x48 | r >> 3; *je++ = 0x89; *je++ = r & 7; }     // mov %rax, (%reg)
+      else if (i == SC)  { if (r > 7) *je++ = 0x41; *je++ = 0x88; *je++ = r & 7; }   // mov %al, (%reg)
+      else if (i == OR)  rr(0x09, r, 0);                                             // or %reg, %rax
+      else if (i == XOR) rr(0x31, r, 0);                                             // xor %reg, %rax
+      else if (i == AND) rr(0x21, r, 0);                                             // and %reg, %rax
+      else if (i == ADD) rr(0x01, r, 0);                                             // add %reg, %rax
+      else if (i == MUL) rr(0x0faf, 0, r);                                           // imul %reg, %rax
+      else if (i == SUB) { rr(0x29, 0, r); rr(0x89, r, 0); }                         // sub %rax, %reg; mov %reg, %rax
+      else if (EQ <= i && i <= GE) {
+        rr(0x39, 0, r);                                                              // cmp %rax, %reg
+        memcpy(je, "\x0f\x94\xc0\x0f\xb6\xc0", 6); je[1] = "\x94\x95\x9c\x9f\x9e\x9d"[i - EQ]; je += 6; // setcc %al; movzbl %al, %eax
+      }
+      else { // SHL, SHR, DIV, MOD take the right operand in %rcx
+        rr(0x89, 0, 1); rr(0x89, r, 0);                                              // mov %rax, %rcx; mov %reg, %rax
+        if      (i == SHL) { memcpy(je, "\x48\xd3\xe0", 3); je += 3; }               // shl %cl, %rax
+        else if (i == SHR) { memcpy(je, "\x48\xd3\xf8", 3); je += 3; }               // sar %cl, %rax
+        else { memcpy(je, "\x48\x99\x48\xf7\xf9", 5); je += 5; }                     // cqo; idiv %rcx
+        if (i == MOD) { memcpy(je, "\x48\x89\xd0", 3); je += 3; }                    // mov %rdx, %rax
+      }
+    }
+    else if (i == PSH && *pc == IMM && (pc[2] == SHL || pc[2] == SHR) && !jitmap[pc - text] && !jitmap[pc + 2 - text]
+             && pc[1] >= 0 && pc[1] < 64) { // shift by a constant, e.g. the pointer scale: no operand to push
+      jitmap[pc - text] = jitmap[pc + 2 - text] = je;
+      memcpy(je, "\x48\xc1\xe0", 3); if (pc[2] == SHR) je[2] = 0xf8; je[3] = pc[1]; je += 4; pc = pc + 3; // shl/sar $n, %rax
+    }
+    else if (i == PSH) { rr(0x89, 0, "\7\6\10\11"[cd++]); }                      // mov %rax, %reg
+    else if (i == LEA) {
+      i = sizeof(int) * *pc++;
+      if (i == (int8_t)i) { memcpy(je, "\x48\x8d\x45", 3); je[3] = i; je += 4; }                    // lea n(%rbp), %rax
+      else if (i == (int32_t)i) { memcpy(je, "\x48\x8d\x85", 3); *(int32_t *)(je + 3) = i; je += 7; } // lea n32(%rbp), %rax
+      else { printf("jit: LEA out of bounds\n"); exit(-1); }
+    }
+    else if (i == ENT) {
+      i = sizeof(int) * *pc++; if (i != (int32_t)i) { printf("jit: ENT out of bounds\n"); exit(-1); }
+      memcpy(je, "\x55\x48\x89\xe5", 4); je += 4;                    // push %rbp; mov %rsp, %rbp
+      if (i > 0 && i < 128) { memcpy(je, "\x48\x83\xec", 3); je[3] = i; je += 4; }             // sub $n, %rsp
+      else if (i > 0) { memcpy(je, "\x48\x81\xec", 3); *(int32_t *)(je + 3) = i; je += 7; }    // sub $n32, %rsp
+    }
+    else if (i == IMM) {
+      if (orel) while (*rlp && *rlp < pc - 1 - text) ++rlp;
+      if (orel && *rlp == pc - 1 - text) { // -o: a data address, relative to the code so that it does not need a fixed address
+        memcpy(je, "\x48\x8d\x05", 3); *++orlp = (int)(je + 3); *++orlp = -1; *++orlp = *pc++; je += 7; // lea rel32(%rip), %rax
+      }
+      else if (*pc == (int32_t)*pc) { memcpy(je, "\x48\xc7\xc0", 3); *(int32_t *)(je + 3) = *pc++; je += 7; } // mov $imm32, %rax
+      else { memcpy(je, "\x48\xb8", 2); *(int64_t *)(je + 2) = *pc++; je += 10; }                      // movabs $imm64, %rax
+    }
+    else if (i == ADJ) {
+      i = sizeof(int) * *pc++; if (i != (int32_t)i) { printf("jit: ADJ out of bounds\n"); exit(-1); }
+      if (i < 128) { memcpy(je, "\x48\x83\xc4", 3); je[3] = i; je += 4; }                   // add $n, %rsp
+      else { memcpy(je, "\x48\x81\xc4", 3); *(int32_t *)(je + 3) = i; je += 7; }            // add $n32, %rsp
+    }
+    else if (i == TAD) { // tail call: move the arguments over ours and leave; the JMP to the callee follows
+      for (k = *pc++ - 1; k >= 0; --k) {
+        if (16 + 8 * k < 128) {
+          memcpy(je, "\x48\x8b\x4c\x24", 4); je[4] = 8 * k; je += 5;                 // mov 8k(%rsp), %rcx
+          memcpy(je, "\x48\x89\x4d", 3); je[3] = 16 + 8 * k; je += 4;                 // mov %rcx, 16+8k(%rbp)
+        }
+        else {
+          memcpy(je, "\x48\x8b\x8c\x24", 4); *(int32_t *)(je + 4) = 8 * k; je += 8;
+          memcpy(je, "\x48\x89\x8d", 3); *(int32_t *)(je + 3) = 16 + 8 * k; je += 7;
+        }
+      }
+      *je++ = 0xc9;                                                                // leave
+    }
+    else if (i == SWT) { // switch: consecutive cases index a table of jmp <off32>, one per JMP, others bisect to it
+      n = *pc++;
+      if (je + 40 * n > jitlim) { printf("jit: executable memory exhausted\n"); exit(-1); }
+      if (n > 1 && pc[4 * n - 3] - pc[1] == n - 1) {
+        if (pc[1] == (int32_t)pc[1]) { memcpy(je, "\x48\x2d", 2); *(int32_t *)(je + 2) = pc[1]; je += 6; } // sub $imm32, %rax
+        else { memcpy(je, "\x48\xb9", 2); *(int64_t *)(je + 2) = pc[1]; memcpy(je + 10, "\x48\x29\xc8", 3); je += 13; } // movabs $imm64, %rcx; sub %rcx, %rax
+        memcpy(je, "\x48\x3d", 2); *(int32_t *)(je + 2) = n; je += 6;                             // cmp $n, %rax
+        memcpy(je, "\x0f\x83", 2); *(int32_t *)(je + 2) = 16 + 5 * n; je += 6;                     // jae <default>
+        memcpy(je, "\x48\x8d\x04\x80\x48\x8d\x0d\x05\0\0\0\x48\x01\xc8\xff\xe0", 16); je += 16;
+        tmp = (int)je; je += 5 * n + 5; // lea (%rax,%rax,4), %rax; lea <table>(%rip), %rcx; add %rcx, %rax; jmp *%rax
+      }
+      else { *je = 0xe9; *(int32_t *)(je + 1) = 5 * n + 5; tmp = (int)je + 5; je += 5 * n + 10; jitcases(pc, 0, n, (char *)tmp, n); }
+      for (k = 0; k < n; ++k) { *(char *)tmp = 0xe9; jitmap[pc - text] = jitmap[pc + 2 - text] = (char *)tmp; tmp += 5; pc += 4; }
+      *(char *)tmp = 0xe9; jitmap[pc - text] = (char *)tmp; pc += 2;                               // the default
+    }
+    else if (i == LEV) { memcpy(je, "\xc9\xc3", 2); je += 2; cd = 0; }          // leave; ret
+    else if (i == LI)  { memcpy(je, "\x48\x8b\x00", 3); je += 3; }                // mov (%rax), %rax
+    else if (i == LC)  { memcpy(je, "\x48\x0f\xbe\x00", 4); je += 4; }            // movsbq (%rax), %rax
+    else if (i == SI)  { memcpy(je, "\x59\x48\x89\x01", 4); je += 4; }            // pop %rcx; mov %rax, (%rcx)
+    else if (i == SC)  { memcpy(je, "\x59\x88\x01", 3); je += 3; }                // pop %rcx; mov %al, (%rcx)
+    else if (i == OR)  { memcpy(je, "\x59\x48\x09\xc8", 4); je += 4; }            // pop %rcx; or %rcx, %rax
+    else if (i == XOR) { memcpy(je, "\x59\x48\x31\xc8", 4); je += 4; }            // pop %rcx; xor %rcx, %rax
+    else if (i == AND) { memcpy(je, "\x59\x48\x21\xc8", 4); je += 4; }            // pop %rcx; and %rcx, %rax
+    else if (EQ <= i && i <= GE) {
+      memcpy(je, "\x59\x48\x39\xc1\x0f\x94\xc0\x0f\xb6\xc0", 10); // pop %rcx; cmp %rax, %rcx; sete %al; movzbl %al, %eax
+      je[5] = "\x94\x95\x9c\x9f\x9e\x9d"[i - EQ]; je += 10;        // sete, setne, setl, setg, setle, setge
+    }
+    else if (i == SHL) { memcpy(je, "\x59\x48\x91\x48\xd3\xe0", 6); je += 6; }    // pop %rcx; xchg %rax, %rcx; shl %cl, %rax
+    else if (i == SHR) { memcpy(je, "\x59\x48\x91\x48\xd3\xf8", 6); je += 6; }    // pop %rcx; xchg %rax, %rcx; sar %cl, %rax
+    else if (i == ADD) { memcpy(je, "\x59\x48\x01\xc8", 4); je += 4; }            // pop %rcx; add %rcx, %rax
+    else if (i == SUB) { memcpy(je, "\x59\x48\x91\x48\x29\xc8", 6); je += 6; }    // pop %rcx; xchg %rax, %rcx; sub %rcx, %rax
+    else if (i == MUL) { memcpy(je, "\x59\x48\x0f\xaf\xc1", 5); je += 5; }        // pop %rcx; imul %rcx, %rax
+    else if (i == DIV || i == MOD) {
+      memcpy(je, "\x59\x48\x91\x48\x99\x48\xf7\xf9", 8); je += 8;  // pop %rcx; xchg %rax, %rcx; cqo; idiv %rcx
+      if (i == MOD) { memcpy(je, "\x48\x89\xd0", 3); je += 3; }   // mov %rdx, %rax
+    }
+    else if (i == JMP) { ++pc; *je = 0xe9; je += 5; }                             // jmp <off32>
+    else if (i == JSR) { ++pc; *je = 0xe8; je += 5; }                             // call <off32>
+    else if (i == BZ)  { ++pc; memcpy(je, "\x48\x85\xc0\x0f\x84", 5); je += 9; }  // test %rax, %rax; jz <off32>
+    else if (i == BNZ) { ++pc; memcpy(je, "\x48\x85\xc0\x0f\x85", 5); je += 9; }  // test %rax, %rax; jnz <off32>
+    else if (i >= OPEN) {
+      tmp = (int)lib[i - OPEN];
+      // SysV: the first six arguments go in registers, the rest on the stack, which must be 16 byte
+      // aligned at the call; c4 pushed them in order, so the last one is on top. The ADJ is folded in.
+      n = (*pc == ADJ) ? pc[1] : 0; if (n) pc += 2;
+      if (n > 15) { printf("jit: too many arguments to a native call\n"); exit(-1); }
+      if (n <= 6) {
+        // argument k goes to "\7\6\2\1\10\11"[k] (%rdi, %rsi, %rdx, %rcx, %r8, %r9): the cached ones are
+        // moved there, the older ones popped; cached entries below the arguments are pushed first
+        s = cd - n;
+        for (k = 0; k < s; ++k) { r = "\7\6\10\11"[k]; if (r > 7) *je++ = 0x41; *je++ = 0x50 | (r & 7); } // push %reg
+        m = 0; for (k = (s < 0) ? -s : 0; k < n; ++k) if ("\7\6\10\11"[k + s] != "\7\6\2\1\10\11"[k]) m |= 1 << k;
+        while (m) { // the moves never form a cycle: do each one once its target is no longer needed as a source
+          for (k = 0; k < n; ++k) if (m >> k & 1) {
+            for (j = 0; j < n && !((m >> j & 1) && "\7\6\10\11"[j + s] == "\7\6\2\1\10\11"[k]); ++j);
+            if (j == n) { rr(0x89, "\7\6\10\11"[k + s], "\7\6\2\1\10\11"[k]); m &= ~(1 << k); } // mov %reg, %arg
+          }
+        }
+        for (k = n - cd - 1; k >= 0; --k) { r = "\7\6\2\1\10\11"[k]; if (r > 7) *je++ = 0x41; *je++ = 0x58 | (r & 7); } // pop %arg
+        cd = 0;
+        memcpy(je, "\x48\x89\xe3\x48\x83\xe4\xf0", 7); je += 7;  // mov %rsp, %rbx; and $-16, %rsp
+      }
+      else {
+        memcpy(je, "\x48\x89\xe3\x48\x83\xe4\xf0", 7); je += 7;  // mov %rsp, %rbx; and $-16, %rsp
+        if (n & 1) { memcpy(je, "\x48\x83\xec\x08", 4); je += 4; } // sub $8, %rsp
+        for (k = n - 1; k >= 6; --k) { memcpy(je, "\xff\x73", 2); je[2] = sizeof(int) * (n - 1 - k); je += 3; } // push m(%rbx)
+        for (k = 0; k < 6; ++k) { // mov m(%rbx), %rdi / %rsi / %rdx / %rcx / %r8 / %r9
+          memcpy(je, &"\x48\x8b\x7b\x48\x8b\x73\x48\x8b\x53\x48\x8b\x4b\x4c\x8b\x43\x4c\x8b\x4b"[3 * k], 3);
+          je[3] = sizeof(int) * (n - 1 - k); je += 4;
+        }
+      }
+      if (orel) { memcpy(je, "\x31\xc0\xe8", 3); *++orlp = (int)(je + 3); *++orlp = i; *++orlp = 0; je += 7; } // xor %eax, %eax; call fn@plt
+      else {
+        memcpy(je, "\x49\xbb", 2); *(int64_t *)(je + 2) = tmp; je += 10;  // movabs $fn, %r11
+        memcpy(je, "\x31\xc0\x41\xff\xd3", 5); je += 5;            // xor %eax, %eax (no vector arguments); call *%r11
+      }
+      if (n > 6) { memcpy(je, "\x48\x8d\x63", 3); je[3] = sizeof(int) * n; je += 4; } // lea m(%rbx), %rsp: drop the arguments
+      else { memcpy(je, "\x48\x89\xdc", 3); je += 3; }                          // mov %rbx, %rsp
+      if (lib32[i - OPEN]) { memcpy(je, "\x48\x63\xc0", 3); je += 3; } // movslq %eax, %rax: it returns an int
+    }
+    else { printf("code generation failed for %d!\n", i); exit(-1); }
+  }
+  if (perffd) jitdebug(f, pc, jitmap[f - text]);
+  return pc;
+}
+
+// fill in the relative offsets of the JMP/JSR/BZ/BNZ from pc up to end
+jitreloc(int *pc, int *end)
+{
+  int i; char *je;
+
+  while (pc < end) {
+    i = *pc; je = jitmap[pc++ - text];
+    if (i == JSR || i == JMP || i == BZ || i == BNZ) {
+      je += (i == BZ || i == BNZ) ? 5 : 1;
+      *(int32_t *)je = jitmap[(int *)*pc++ - text] - (je + 4);
+    }
+    else if (i < LEV) { ++pc; }
   }
 }
 
+// compile the function f, at its ENT, and the functions it calls, unless they are compiled already
+jithot(int *f)
+{
+  int *pc, *end;
+
+  if (jitmap[f - text] > (char *)1) return;
+  end = jitcode(f);
+  for (pc = f; pc < end; pc += (*pc < LEV) ? 2 : 1) {
+    if (*pc == JSR) jithot((int *)pc[1]);
+    else if (*pc == TAD) jithot((int *)pc[3]); // and its JMP
+  }
+  jitreloc(f, end);
+}
+
+// -o: write the native code from start to je and the data as an ELF relocatable object, for the C compiler
+// to link with libc; its main is the entry stub at start, which calls c4's main
+jitobj(char *ofile, char *start)
+{
+  int fd, n, k, gsym, *r;
+  char *b, *o, *str, *code, *dat, *symtab, *strtab, *rela, *shstr;
+
+  for (r = orel + 1; r <= orlp; r += 3) if (r[1] == MRST) { // the allocator of c4x86 does not go into the object
+    printf("%s: mreset() is not in libc, so a program calling it cannot be written out with -o\n", ofile); exit(-1);
+  }
+  n = (symend - sym) / Idsz;
+  if (!(str = malloc(n * 64 + 16)) || !(b = malloc(4096 + (je - start) + (data - dbase) + n * 24 + (orlp - orel) * 8))) {
+    printf("could not malloc object\n"); exit(-1);
+  }
+  elfhdr(b, 8, 6); o = b + 64;
+  code = o; memcpy(o, start, je - start); o += je - start;
+  o = (char *)((int)(o + 7) & -8);
+  dat = o; memcpy(o, dbase, data - dbase); o += data - dbase;
+
+  // symbols: null, .data, c4's functions; then main and the library, undefined, in opcode order
+  o = (char *)((int)(o + 7) & -8);
+  symtab = o; memset(o, 0, 48); o[28] = 3; *(int16_t *)(o + 30) = 2; o += 48; // STT_SECTION
+  k = 1; *str = 0;
+  for (id = sym; id < symend; id += Idsz) if (id[Class] == Fun) {
+    memset(o, 0, 24); *(int32_t *)o = k; o[4] = 2; *(int16_t *)(o + 6) = 1;   // local function in .text
+    *(int64_t *)(o + 8) = jitmap[(int *)id[Val] - text] - start; o += 24;
+    memcpy(str + k, (char *)id[Name], id[Hash] & 63); k += (id[Hash] & 63) + 1; str[k - 1] = 0;
+  }
+  gsym = (o - symtab) / 24;
+  memset(o, 0, 24); *(int32_t *)o = k; o[4] = 18; *(int16_t *)(o + 6) = 1; *(int64_t *)(o + 16) = 14; o += 24; // global function
+  memcpy(str + k, "main", 5); k += 5;
+  for (n = OPEN; n <= EXIT; ++n) {
+    for (id = sym; !(id[Class] == Sys && id[Val] == n); id += Idsz);
+    memset(o, 0, 24); *(int32_t *)o = k; o[4] = 16; o += 24;                   // global, undefined
+    memcpy(str + k, (char *)id[Name], id[Hash] & 63); k += (id[Hash] & 63) + 1; str[k - 1] = 0;
+  }
+  strtab = o; memcpy(o, str, k); o += k;
+
+  o = (char *)((int)(o + 7) & -8);
+  rela = o;
+  for (r = orel + 1; r <= orlp; r += 3) {
+    *(int64_t *)o = r[0] - (int)start;
+    if (r[1] < 0) { *(int64_t *)(o + 8) = (int)1 << 32 | 2; *(int64_t *)(o + 16) = r[2] - (int)dbase - 4; }  // R_X86_64_PC32 .data
+    else { *(int64_t *)(o + 8) = (gsym + 1 + r[1] - OPEN) << 32 | 4; *(int64_t *)(o + 16) = -4; }           // R_X86_64_PLT32 fn
+    o += 24;
+  }
+  shstr = o; memcpy(o, "\0.text\0.data\0.symtab\0.strtab\0.rela.text\0.shstrtab\0.note.GNU-stack", 66); o += 66;
+
+  o = (char *)((int)(o + 7) & -8);
+  *(int64_t *)(b + 40) = o - b; memset(o, 0, 64); o += 64;
+  o = elfsh(o, 1, 1, 6, 0, code - b, je - start, 0, 0, 16, 0);              // .text: alloc, exec
+  o = elfsh(o, 7, 1, 3, 0, dat - b, data - dbase, 0, 0, 8, 0);              // .data: write, alloc
+  o = elfsh(o, 13, 2, 0, 0, symtab - b, strtab - symtab, 4, gsym, 8, 24);   // .symtab, names in 4
+  o = elfsh(o, 21, 3, 0, 0, strtab - b, k, 0, 0, 1, 0);                     // .strtab
+  o = elfsh(o, 29, 4, 64, 0, rela - b, shstr - rela, 3, 1, 8, 24);          // .rela.text: symbols in 3, for 1
+  o = elfsh(o, 40, 3, 0, 0, shstr - b, 66, 0, 0, 1, 0);                     // .shstrtab
+  o = elfsh(o, 50, 1, 0, 0, shstr - b, 0, 0, 0, 1, 0);                      // .note.GNU-stack: the stack is not executable
+
+  if ((fd = open(ofile, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) { printf("could not open(%s)\n", ofile); exit(-1); }
+  if (write(fd, b, o - b) != o - b) { printf("could not write(%s)\n", ofile); exit(-1); }
+  close(fd);
+  free(str); free(b);
+}
+
 main(int argc, char **argv)
 {
   int fd, bt, ty, poolsz, *idmain;
-  int *pc;
-  int i, tmp; // temps
+  int *ls, *lsp; // identifiers shadowed by the current function's parameters and locals
+  int *pc, *sp, *bp, a, *stk, *f; // vm registers
+  int i, *t, aot; // temps
+  int (*jitmain)(int, char **);
+  int (*jitenter)(char *, int *, int *, int); char *jitexit, *pf, *ofile;
 
   --argc; ++argv;
   if (argc > 0 && **argv == '-' && (*argv)[1] == 's') { src = 1; --argc; ++argv; }
-  if (argc < 1) { printf("usage: c4 [-s] file ...\n"); return -1; }
-
-  if ((fd = open(*argv, 0)) < 0) { printf("could not open(%s)\n", *argv); return -1; }
-
-  poolsz = 256*1024; // arbitrary size
-  if (!(sym = malloc(poolsz))) { printf("could not malloc(%d) symbol area\n", poolsz); return -1; }
-  if (!(text = le = e = malloc(poolsz))) { printf("could not malloc(%d) text area\n", poolsz); return -1; }
-  if (!(data = malloc(poolsz))) { printf("could not malloc(%d) data area\n", poolsz); return -1; }
+  aot = 0;
+  if (argc > 0 && **argv == '-' && (*argv)[1] == 'a') { aot = 1; --argc; ++argv; }
+  if (argc > 0 && **argv == '-' && (*argv)[1] == 'g') { perffd = -1; --argc; ++argv; }
+  if (argc > 0 && **argv == '-' && (*argv)[1] == 'l') { oline = 1; --argc; ++argv; }
+  ofile = 0;
+  if (argc > 1 && **argv == '-' && (*argv)[1] == 'o') { ofile = argv[1]; argc = argc - 2; argv = argv + 2; }
+  srcv = argv; nsrc = 1;
+  if (argc > 0 && **argv == '-' && (*argv)[1] == 'm') { // every file up to "--" is part of the program
+    srcv = ++argv; --argc;
+    for (nsrc = 0; nsrc < argc && strcmp(argv[nsrc], "--"); ++nsrc);
+    if (nsrc < argc) { argv[nsrc] = argv[nsrc - 1]; ++argv; --argc; } // "--" becomes the program's argv[0]
+    argv += nsrc - 1; argc -= nsrc - 1;
+  }
+  if (argc < 1 || nsrc < 1) { printf("usage: c4x86 [-s] [-a] [-g] [-l] [-o object] [-m file ... --] file ...\n"); return -1; }
 
-  memset(sym,  0, poolsz);
-  memset(e,    0, poolsz);
-  memset(data, 0, poolsz);
+  // areas are reserved up front and committed by the kernel page by page as they are touched
+  poolsz = 64*1024*1024;
+  if ((symend = sym = mmap(0, poolsz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0)) == MAP_FAILED) { printf("could not mmap(%d) symbol area\n", poolsz); return -1; }
+  if ((hsym = mmap(0, 4 * poolsz / Idsz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0)) == MAP_FAILED) { printf("could not mmap(%d) symbol index area\n", 4 * poolsz / Idsz); return -1; }
+  if ((lsp = ls = mmap(0, poolsz / Idsz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0)) == MAP_FAILED) { printf("could not mmap(%d) scope area\n", poolsz / Idsz); return -1; }
+  if ((text = le = e = mmap(0, poolsz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0)) == MAP_FAILED) { printf("could not mmap(%d) text area\n", poolsz); return -1; }
+  if ((srcmap = mmap(0, poolsz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0)) == MAP_FAILED) { printf("could not mmap(%d) source map area\n", poolsz); return -1; }
+  if ((cas = mmap(0, poolsz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0)) == MAP_FAILED) { printf("could not mmap(%d) case area\n", poolsz); return -1; }
+  caslim = cas + poolsz / sizeof(int) - 2;
+  if ((dbase = data = mmap(0, poolsz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0)) == MAP_FAILED) { printf("could not mmap(%d) data area\n", poolsz); return -1; }
+  if ((rlp = reloc = mmap(0, poolsz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0)) == MAP_FAILED) { printf("could not mmap(%d) relocation area\n", poolsz); return -1; }
+  symlim = sym + poolsz / sizeof(int) - Idsz;
+  elim = text + poolsz / sizeof(int) - 1024;
+  dlim = data + poolsz - 1024;
+  hmask = 1023; // grows with the symbol table
 
-  p = "char else enum if int return while "
-      "open read close printf malloc memset memcmp exit main";
-  i = Char; while (i <= While) { next(); id[Tk] = i++; } // add keywords to symbol table
-  i = OPEN; while (i <= EXIT) { next(); id[Class] = Sys; id[Type] = TYINT; id[Val] = i++; } // add library to symbol table
-  next(); idmain = id; // keep track of main
+  p = "char else enum if int return while break case default switch";
+  i = Char; while (*p) { next(); id[Tk] = i++; } // add keywords to symbol table
+  p = "open read close printf malloc free mreset memset memcmp mmap munmap memcpy lseek write dprintf snprintf exit"; // as in lib
+  i = OPEN; while (*p) { next(); id[Class] = Sys; id[Type] = TYINT; id[Val] = i++; } // add library to symbol table
+  p = "main"; next(); idmain = id; // keep track of main
 
-  if (!(lp = p = malloc(poolsz))) { printf("could not malloc(%d) source area\n", poolsz); return -1; }
-  if ((i = read(fd, p, poolsz-1)) <= 0) { printf("read() returned %d\n", i); return -1; }
-  close(fd);
-  p[i] = 0;
-  linemap = (char **)(((int)(p + i + 1) & 0xffffff00) + 0x100);
-  srcmap = text + (poolsz / 8);
+  // map each source file read-only without copying it: the file is mapped over an anonymous
+  // mapping one byte longer, so the zero fill past its end terminates it
+  if (!(srcs = malloc(nsrc * sizeof(char *))) || !(lbase = calloc(nsrc + 1, sizeof(int)))) { printf("could not malloc(%d) source list\n", nsrc); return -1; }
+  for (fno = 0; fno < nsrc; ++fno) {
+    if ((fd = open(srcv[fno], 0)) < 0) { printf("could not open(%s)\n", srcv[fno]); return -1; }
+    if ((i = lseek(fd, 0, SEEK_END)) < 0) { printf("could not lseek(%s)\n", srcv[fno]); return -1; }
+    if ((srcs[fno] = mmap(0, i + 1, PROT_READ, MAP_PRIVATE | MAP_ANON, -1, 0)) == MAP_FAILED) { printf("could not mmap(%d) source area\n", i + 1); return -1; }
+    if (i && mmap(srcs[fno], i, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) { printf("could not mmap(%s)\n", srcv[fno]); return -1; }
+    close(fd);
+  }
+  if ((linemap = mmap(0, poolsz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0)) == MAP_FAILED) { printf("could not mmap(%d) line map area\n", poolsz); return -1; }
 
   // parse declarations
-  line = 1;
+  lp = p = *srcs; fname = *srcv; fno = 0; line = 1;
   next();
   while (tk) {
     bt = TYINT; // basetype
@@ -380,11 +1099,11 @@ main(int argc, char **argv)
         next();
         i = 0;
         while (tk != '}') {
-          if (tk != Id) { printf("%d: bad enum identifier %d\n", line, tk); return -1; }
+          if (tk != Id) { printf("%s:%d: bad enum identifier %d\n", fname, line, tk); return -1; }
           next();
           if (tk == Assign) {
             next();
-            if (tk != Num) { printf("%d: bad enum initializer\n", line); return -1; }
+            if (tk != Num) { printf("%s:%d: bad enum initializer\n", fname, line); return -1; }
             i = ival;
             next();
           }
@@ -397,8 +1116,8 @@ main(int argc, char **argv)
     while (tk != ';' && tk != '}') {
       ty = bt;
       while (tk == Mul) { next(); ty = ty + PTR; }
-      if (tk != Id) { printf("%d: bad global declaration\n", line); return -1; }
-      if (id[Class]) { printf("%d: duplicate global definition\n", line); return -1; }
+      if (tk != Id) { printf("%s:%d: bad global declaration\n", fname, line); return -1; }
+      if (id[Class]) { printf("%s:%d: duplicate global definition\n", fname, line); return -1; }
       next();
       id[Type] = ty;
       if (tk == '(') { // function
@@ -410,8 +1129,9 @@ main(int argc, char **argv)
           if (tk == Int) next();
           else if (tk == Char) { next(); ty = TYCHAR; }
           while (tk == Mul) { next(); ty = ty + PTR; }
-          if (tk != Id) { printf("%d: bad parameter declaration\n", line); return -1; }
-          if (id[Class] == Loc) { printf("%d: duplicate parameter definition\n", line); return -1; }
+          if (tk != Id) { printf("%s:%d: bad parameter declaration\n", fname, line); return -1; }
+          if (id[Class] == Loc) { printf("%s:%d: duplicate parameter definition\n", fname, line); return -1; }
+          *++lsp = (int)id;
           id[HClass] = id[Class]; id[Class] = Loc;
           id[HType]  = id[Type];  id[Type] = ty;
           id[HVal]   = id[Val];   id[Val] = i++;
@@ -419,7 +1139,7 @@ main(int argc, char **argv)
           if (tk == ',') next();
         }
         next();
-        if (tk != '{') { printf("%d: bad function definition\n", line); return -1; }
+        if (tk != '{') { printf("%s:%d: bad function definition\n", fname, line); return -1; }
         loc = ++i;
         next();
         while (tk == Int || tk == Char) {
@@ -428,8 +1148,9 @@ main(int argc, char **argv)
           while (tk != ';') {
             ty = bt;
             while (tk == Mul) { next(); ty = ty + PTR; }
-            if (tk != Id) { printf("%d: bad local declaration\n", line); return -1; }
-            if (id[Class] == Loc) { printf("%d: duplicate local definition\n", line); return -1; }
+            if (tk != Id) { printf("%s:%d: bad local declaration\n", fname, line); return -1; }
+            if (id[Class] == Loc) { printf("%s:%d: duplicate local definition\n", fname, line); return -1; }
+            *++lsp = (int)id;
             id[HClass] = id[Class]; id[Class] = Loc;
             id[HType]  = id[Type];  id[Type] = ty;
             id[HVal]   = id[Val];   id[Val] = ++i;
@@ -441,120 +1162,185 @@ main(int argc, char **argv)
         *++e = ENT; *++e = i - loc;
         while (tk != '}') stmt();
         *++e = LEV;
-        id = sym; // unwind symbol table locals
-        while (id[Tk]) {
-          if (id[Class] == Loc) {
-            id[Class] = id[HClass];
-            id[Type] = id[HType];
-            id[Val] = id[HVal];
-          }
-          id = id + Idsz;
+        while (lsp > ls) { // unwind symbol table locals
+          id = (int *)*lsp--;
+          id[Class] = id[HClass];
+          id[Type] = id[HType];
+          id[Val] = id[HVal];
         }
       }
       else {
         id[Class] = Glo;
         id[Val] = (int)data;
-        data = data + 4;
+        data = data + sizeof(int);
       }
       if (tk == ',') next();
     }
     next();
   }
 
+  linemap[lbase[fno] + line] = lp;
+  while (le < e) srcmap[++le - text] = fno << 24 | line;
+  lbase[nsrc] = lbase[fno] + line + 1;
+
+  if (!idmain[Val]) { printf("main() not defined\n"); return -1; }
+
   // setup jit memory
   jitmem = mmap(0, poolsz, PROT_EXEC | PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
-  if (!jitmem) { printf("could not mmap(%d) jit executable memory\n", poolsz); return -1; }
+  if (jitmem == MAP_FAILED) { printf("could not mmap(%d) jit executable memory\n", poolsz); return -1; }
+  jitlim = jitmem + poolsz - 256;
+  jitmap = mmap(0, poolsz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+  if (jitmap == MAP_FAILED) { printf("could not mmap(%d) jit address map\n", poolsz); return -1; }
+  if ((hot = mmap(0, poolsz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0)) == MAP_FAILED) { printf("could not mmap(%d) call counts\n", poolsz); return -1; }
+  osz = 1024 * 1024;
+  if ((obuf = mmap(0, osz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0)) == MAP_FAILED) { printf("could not mmap(%d) output buffer\n", osz); return -1; }
+  atexit(outflush);
+
+  // entry from C: keep %rbx for the caller, push argc and argv in c4 order and call main
+  je = jitmem;
+  memcpy(je, "\x53\x57\x56\xe8", 4); je += 8;      // push %rbx; push %rdi; push %rsi; call <main>
+  memcpy(je, "\x48\x83\xc4\x10\x5b\xc3", 6); je += 6; // add $16, %rsp; pop %rbx; ret
 
-  // first pass: emit native code
-  pc = text + 1; je = jitmem; line = 0;
+  // entry from the interpreter: jitenter(code, bp, sp, a) runs code on the c4 stack with the
+  // c4 registers; a return to jitexit switches back to the C stack and returns %rax
+  jitenter = (void *)je;
+  memcpy(je, "\x53\x55\x49\xbb", 4); *(int64_t *)(je + 4) = (int)&jitsp; je += 12; // push %rbx; push %rbp; movabs $jitsp, %r11
+  memcpy(je, "\x49\x89\x23\x48\x89\xf5\x48\x89\xd4\x48\x89\xc8\xff\xe7", 14); je += 14; // mov %rsp, (%r11); mov %rsi, %rbp;
+                                                                                          // mov %rdx, %rsp; mov %rcx, %rax; jmp *%rdi
+  jitexit = je;
+  memcpy(je, "\x49\xbb", 2); *(int64_t *)(je + 2) = (int)&jitsp; je += 10;  // movabs $jitsp, %r11
+  memcpy(je, "\x49\x8b\x23\x5d\x5b\xc3", 6); je += 6;                     // mov (%r11), %rsp; pop %rbp; pop %rbx; ret
+
+  if (perffd) {
+    if (!(pf = malloc(32))) { printf("could not malloc(32) perf map name\n"); return -1; }
+    sprintf(pf, "/tmp/perf-%d.map", (int32_t)getpid());
+    if ((perffd = open(pf, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) { printf("could not open(%s)\n", pf); return -1; }
+    dprintf(perffd, "%lx %lx c4x86 stubs\n", jitmem, je - jitmem);
+  }
+
+  // mark the branch targets: the register cache is spilled where control flow joins;
+  // the operand of each JMP keeps its function in hot, for compiling it when the loop gets hot
+  pc = text + 1;
   while (pc <= e) {
-    i = *pc;
-    if (src) {
-        while (line < srcmap[pc - text]) {
-            line++; printf("% 4d | %.*s", line, linemap[line + 1] - linemap[line], linemap[line]);
-        }
-        printf("0x%05x (%p):\t%8.4s", pc - text, je,
-                        &"LEA ,IMM ,JMP ,JSR ,BZ  ,BNZ ,ENT ,ADJ ,LEV ,LI  ,LC  ,SI  ,SC  ,PSH ,"
-                         "OR  ,XOR ,AND ,EQ  ,NE  ,LT  ,GT  ,LE  ,GE  ,SHL ,SHR ,ADD ,SUB ,MUL ,DIV ,MOD ,"
-                         "OPEN,READ,CLOS,PRTF,MALC,MSET,MCMP,EXIT,"[i * 5]);
-        if (i <= ADJ) printf(" 0x%x\n", *(pc + 1)); else printf("\n");
+    i = *pc++;
+    if (i == ENT) f = pc - 1;
+    if (i == JMP) hot[pc - text] = (int)f;
+    if (i == JSR || i == JMP || i == BZ || i == BNZ) jitmap[(int *)*pc++ - text] = (char *)1;
+    else if (i < LEV) ++pc;
+  }
+
+  if (ofile) { // compile it all after a fresh entry stub and write it out
+    if ((orlp = orel = mmap(0, poolsz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0)) == MAP_FAILED) { printf("could not mmap(%d) object relocation area\n", poolsz); return -1; }
+    f = (int *)je;
+    memcpy(je, "\x53\x57\x56\xe8", 4); je += 8;      // push %rbx; push %rdi; push %rsi; call <main>
+    memcpy(je, "\x48\x83\xc4\x10\x5b\xc3", 6); je += 6; // add $16, %rsp; pop %rbx; ret
+    pc = text + 1; rlp = reloc + 1; fno = line = 0;
+    if (src && nsrc > 1) printf("%s:\n", *srcv);
+    while (pc <= e) pc = jitcode(pc);
+    jitreloc(text + 1, e + 1);
+    *(int32_t *)((char *)f + 4) = jitmap[(int *)idmain[Val] - text] - ((char *)f + 8);
+    jitobj(ofile, (char *)f);
+    return 0;
+  }
+
+  if (src || aot) { // compile it all and run main natively
+    pc = text + 1; fno = line = 0;
+    if (src && nsrc > 1) printf("%s:\n", *srcv);
+    while (pc <= e) pc = jitcode(pc);
+    jitreloc(text + 1, e + 1);
+    *(int32_t *)(jitmem + 4) = jitmap[(int *)idmain[Val] - text] - (jitmem + 8);
+    jitmain = (void *)jitmem;
+    return jitmain(argc, argv);
+  }
+
+  // setup stack
+  if ((sp = mmap(0, poolsz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0)) == MAP_FAILED) { printf("could not mmap(%d) stack area\n", poolsz); return -1; }
+  stk = sp + 1024; // room for the temporaries and arguments pushed below a frame
+  sp = (int *)((int)sp + poolsz);
+  *--sp = EXIT; // call exit if main returns
+  *--sp = PSH; t = sp;
+  *--sp = argc;
+  *--sp = (int)argv;
+  *--sp = (int)t;
+
+  // run: interpret, and compile a function into native code once it is called often or loops
+  // often; the interpreter's frames are laid out like the native ones, so they can be mixed
+  pc = (int *)idmain[Val];
+  while (1) {
+    i = *pc++;
+    if (i == LEA) a = (int)(bp + *pc++);                              // load local address
+    else if (i == IMM) a = *pc++;                                     // load global address or immediate
+    else if (i == JMP) {                                              // jump
+      t = (int *)*pc;
+      if (t < pc && ++hot[pc - 1 - text] >= 1000) { // a hot loop: compile its function and go on from t natively
+        jithot((int *)hot[pc - text]);
+        i = bp[1]; bp[1] = (int)jitexit;                              // the native return comes back here
+        a = jitenter(jitmap[t - text], bp, sp, a);
+        sp = bp + 2; bp = (int *)*bp; pc = (int *)i;
+      }
+      else pc = t;
     }
-    *pc++ = ((int)je << 8) | i; // for later relocation of JMP/JSR/BZ/BNZ
-    if (i == LEA) {
-      i = 4 * *pc++; if (i < -128 || i > 127) { printf("jit: LEA out of bounds\n"); return -1; }
-      *(int*)je = 0x458d; je = je + 2; *je++ = i;  // leal $(4 * n)(%ebp), %eax
+    else if (i == JSR) {                                              // jump to subroutine
+      t = (int *)*pc++;
+      if (jitmap[t - text] > (char *)1) { sp[-1] = (int)jitexit; a = jitenter(jitmap[t - text], bp, sp - 1, a); }
+      else { *--sp = (int)pc; pc = t; }
     }
-    else if (i == ENT) {
-      i = 4 * *pc++; if (i < -128 || i > 127) { printf("jit: ENT out of bounds\n"); return -1; }
-      *(int *)je = 0xe58955; je = je + 3;  // push %ebp; movl %esp, %ebp
-      if (i > 0) { *(int *)je = 0xec83; je = je + 2; *(int*)je++ = i; } // subl $(i*4), %esp
-    }
-    else if (i == IMM) { *je++ = 0xb8; *(int *)je = *pc++; je = je + 4; } // movl $imm, %eax
-    else if (i == ADJ) { i = 4 * *pc++; *(int *)je = 0xc483; je = je + 2; *(int *)je = i; je++; } // addl $(n * 4), %esp
-    else if (i == PSH)   *(int *)je++ = 0x50;                    // push %eax
-    else if (i == LEV) { *(int *)je = 0xc35dec89; je = je + 4; } // mov %ebp, %esp; pop %ebp; ret
-    else if (i == LI)  { *(int *)je = 0x008b;     je = je + 2; } // movl (%eax), %eax
-    else if (i == LC)  { *(int *)je = 0x00b60f;   je = je + 3; } // movzbl (%eax), %eax
-    else if (i == SI)  { *(int *)je = 0x018959;   je = je + 3; } // pop %ecx; movl %eax, (%ecx)
-    else if (i == SC)  { *(int *)je = 0x018859;   je = je + 3; } // pop %ecx; movb %al, (%ecx)
-    else if (i == OR)  { *(int *)je = 0xc80959;   je = je + 3; } // pop %ecx; orl %ecx, %eax
-    else if (i == XOR) { *(int *)je = 0xc83159;   je = je + 3; } // pop %ecx; xorl %ecx, %eax
-    else if (i == AND) { *(int *)je = 0xc82159;   je = je + 3; } // pop %ecx; andl %ecx, %eax
-    else if (EQ <= i && i <= GE) {
-        *(int*)je=0x0fc13959; je+=4; *(int*)je=0x9866c094; // pop %ecx; cmp %ecx, %eax; sete %al; cbw; - EQ
-        if      (i == NE)  { *je = 0x95; } // setne %al
-        else if (i == LT)  { *je = 0x9c; } // setl %al
-        else if (i == GT)  { *je = 0x9f; } // setg %al
-        else if (i == LE)  { *je = 0x9e; } // setle %al
-        else if (i == GE)  { *je = 0x9d; } // setge %al
-        je+=4; *je++=0x98;  // cwde
-    }
-    else if (i == SHL) { *(int*)je = 0xe0d39159; je = je + 4; } // pop %ecx; xchg %eax, %ecx; shl %cl, %eax
-    else if (i == SHR) { *(int*)je = 0xe8d39159; je = je + 4; } // pop %ecx; xchg %eax, %ecx; shr %cl, %eax
-    else if (i == ADD) { *(int*)je = 0xc80159;   je = je + 3; } // pop %ecx; addl %ecx, %eax
-    else if (i == SUB) { *(int*)je = 0xc8299159; je = je + 4; } // pop %ecx; xchg %eax, %ecx; subl %ecx, %eax
-    else if (i == MUL) { *(int*)je = 0xc1af0f59; je = je + 4; } // pop %ecx; imul %ecx, %eax
-    else if (i == DIV) { *(int*)je = 0xf9f79159; je = je + 4; } // pop %ecx; xchg %eax, %ecx; idiv %ecx, %eax
-    else if (i == MOD) { *(int*)je = 0xd2319159; je += 4; *(int *)je = 0x92f9f7; je += 3; }
-    else if (i == JMP) { ++pc; *je       = 0xe9;     je = je + 5; } // jmp <off32>
-    else if (i == JSR) { ++pc; *je       = 0xe8;     je = je + 5; } // call <off32>
-    else if (i == BZ)  { ++pc; *(int*)je = 0x840fc085; je = je + 8; } // test %eax, %eax; jz <off32>
-    else if (i == BNZ) { ++pc; *(int*)je = 0x850fc085; je = je + 8; } // test %eax, %eax; jnz <off32>
-    else if (i >= OPEN) {
-      if      (i == OPEN) tmp = (int)open;   else if (i == READ) tmp = (int)read;
-      else if (i == CLOS) tmp = (int)close;  else if (i == PRTF) tmp = (int)printf;
-      else if (i == MALC) tmp = (int)malloc; else if (i == MSET) tmp = (int)memset;
-      else if (i == MCMP) tmp = (int)memcmp; else if (i == EXIT) tmp = (int)exit;
-      if (*pc++ == ADJ) { i = *pc++; } else { printf("no ADJ after native proc!\n"); exit(2); }
-      *je++ = 0xb9; *(int*)je = i << 2; je += 4;  // movl $(4 * n), %ecx;
-      *(int*)je = 0xce29e689; je += 4; // mov %esp, %esi; sub %ecx, %esi;  -- %esi will adjust the stack
-      *(int*)je = 0x8302e9c1; je += 4; // shr $2, %ecx; and                -- alignment of %esp for OS X
-      *(int*)je = 0x895af0e6; je += 4; // $0xfffffff0, %esi; pop %edx; mov..
-      *(int*)je = 0xe2fc8e54; je += 4; // ..%edx, -4(%esi,%ecx,4); loop..  -- reversing args order
-      *(int*)je = 0xe8f487f9; je += 4; // ..<'pop' offset>; xchg %esi, %esp; call    -- saving old stack in %esi
-      *(int*)je = tmp - (int)(je + 4); je = je + 4; // <*tmp offset>;
-      *(int*)je = 0xf487; je += 2;     // xchg %esi, %esp  -- ADJ, back to old stack without arguments
-    }
-    else { printf("code generation failed for %d!\n", i); return -1; }
-  }
-
-  // second pass, relocation
-  pc = text + 1;
-  while (pc <= e) {
-    i = *pc & 0xff;
-    je = (char*)(((unsigned)*pc++ >> 8) | ((unsigned)jitmem & 0xff000000)); // MSB is restored from jitmem
-    if (i == JSR || i == JMP || i == BZ || i == BNZ) {
-        tmp = (*(unsigned*)(*pc++) >> 8) | ((unsigned)jitmem & 0xff000000); // extract address
-        if      (i == JSR || i == JMP) { je += 1; *(int*)je = tmp - (int)(je + 4); }
-        else if (i == BZ  || i == BNZ) { je += 4; *(int*)je = tmp - (int)(je + 4); }
+    else if (i == BZ)  pc = a ? pc + 1 : (int *)*pc;                  // branch if zero
+    else if (i == BNZ) pc = a ? (int *)*pc : pc + 1;                  // branch if not zero
+    else if (i == ENT) {                                              // enter subroutine
+      if (++hot[pc - 1 - text] == 100) jithot(pc - 1);                // later calls run natively
+      *--sp = (int)bp; bp = sp; sp = sp - *pc++;
+      if (sp < stk) { outflush(); printf("stack overflow!\n"); return -1; }
     }
-    else if (i < LEV) { ++pc; }
-  }
+    else if (i == ADJ) sp = sp + *pc++;                               // stack adjust
+    else if (i == TAD) {                                              // tail call, with the JMP after it
+      i = *pc++; while (i) { --i; bp[2 + i] = sp[i]; }
+      sp = bp + 1; bp = (int *)*bp; t = (int *)pc[1];
+      if (jitmap[t - text] > (char *)1) { pc = (int *)*sp; *sp = (int)jitexit; a = jitenter(jitmap[t - text], bp, sp, a); ++sp; }
+      else pc = t;
+    }
+    else if (i == SWT) {                                              // switch: the JMP of the case of a, or the default
+      i = *pc++; t = pc; pc = pc + 4 * i;
+      if (i > 1 && t[4 * i - 3] - t[1] == i - 1) { if (a >= t[1] && a <= t[4 * i - 3]) pc = t + 4 * (a - t[1]) + 2; }
+      else {
+        while (i > 1) { if (t[4 * (i / 2) + 1] <= a) { t = t + 4 * (i / 2); i = i - i / 2; } else i = i / 2; }
+        if (i && t[1] == a) pc = t + 2;
+      }
+      pc = (int *)pc[1];
+    }
+    else if (i == LEV) { sp = bp; bp = (int *)*sp++; pc = (int *)*sp++; } // leave subroutine
+    else if (i == LI)  a = *(int *)a;                                 // load int
+    else if (i == LC)  a = *(char *)a;                                // load char
+    else if (i == SI)  *(int *)*sp++ = a;                             // store int
+    else if (i == SC)  a = *(char *)*sp++ = a;                        // store char
+    else if (i == PSH) *--sp = a;                                     // push
 
-  // run jitted code
-  int (*jitmain)(char**, int); // c4 vm pushes first argument first, unlike cdecl
-  jitmain = (void *)(*(unsigned*)(idmain[Val]) >> 8 | ((unsigned)jitmem & 0xff000000));
-  return jitmain(argv, argc);
+    else if (i == OR)  a = *sp++ |  a;
+    else if (i == XOR) a = *sp++ ^  a;
+    else if (i == AND) a = *sp++ &  a;
+    else if (i == EQ)  a = *sp++ == a;
+    else if (i == NE)  a = *sp++ != a;
+    else if (i == LT)  a = *sp++ <  a;
+    else if (i == GT)  a = *sp++ >  a;
+    else if (i == LE)  a = *sp++ <= a;
+    else if (i == GE)  a = *sp++ >= a;
+    else if (i == SHL) a = *sp++ << a;
+    else if (i == SHR) a = *sp++ >> a;
+    else if (i == ADD) a = *sp++ +  a;
+    else if (i == SUB) a = *sp++ -  a;
+    else if (i == MUL) a = *sp++ *  a;
+    else if (i == DIV) a = *sp++ /  a;
+    else if (i == MOD) a = *sp++ %  a;
+
+    else if (i == EXIT) exit(*sp);                                    // not followed by an ADJ in the exit stub
+    else if (i >= OPEN) { // the library, with as many arguments as the native calls take
+      t = sp + ((*pc == ADJ) ? pc[1] : 0); i = i - OPEN;
+      a = ((int (*)(int, ...))lib[i])(t[-1], t[-2], t[-3], t[-4], t[-5], t[-6], t[-7], t[-8],
+                                      t[-9], t[-10], t[-11], t[-12], t[-13], t[-14], t[-15]);
+      if (lib32[i]) a = (int32_t)a;
+    }
+    else { outflush(); printf("unknown instruction = %d!\n", i); return -1; }
+  }
 }
 
 
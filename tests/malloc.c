@@ -0,0 +1,30 @@
+int main() {
+    int *a, *b, *c, i, n;
+    char *big;
+
+    a = malloc(100);
+    b = malloc(100);
+    printf("a != b             : %d\n", a != b);
+    free(a);
+    c = malloc(100);
+    printf("freed a reused     : %d\n", c == a);
+    c = malloc(100);
+    printf("fresh block        : %d\n", c != a && c != b);
+    printf("malloc(-1)         : %d\n", malloc(-1) == 0);
+    printf("malloc(2^62 + 1)   : %d\n", malloc(4611686018427387905) == 0);
+
+    big = malloc(8000000);
+    n = 8000000;
+    i = 0; while (i < n) { big[i] = i % 100; ++i; }
+    printf("big[n - 1]         : %d\n", big[n - 1]);
+    free(big);
+
+    i = 0; while (i < 100000) { a = malloc(i % 300); *a = i; ++i; }
+    printf("last block         : %d\n", *a);
+    mreset();
+    b = malloc(100);
+    *b = 7;
+    printf("after mreset       : %d\n", *b);
+    free(b);
+    return 0;
+}
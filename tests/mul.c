@@ -0,0 +1,11 @@
+int main() {
+    int x;
+
+    x = 3;
+    printf("x * 8          : %d\n", x * 8);
+    printf("x * 1024       : %d\n", x * 1024);
+    printf("x * 2^32 / 2^32: %d\n", x * 4294967296 / 4294967296);
+    printf("x * 2^40 >> 40 : %d\n", x * 1099511627776 >> 40);
+    printf("2^33 == 2 * 2^32 : %d\n", 8589934592 == 2 * 4294967296);
+    return 0;
+}
@@ -0,0 +1,10 @@
+// the second file of a program in two: ./c4 -m tests/twice.c tests/multi.c --
+int main() {
+    int i, s;
+
+    i = 0; s = 0;
+    while (i < 1000) { s = s + twice(i); ++i; }
+    printf("sum of twice(0..999) : %d\n", s);
+    printf("calls                : %d\n", calls);
+    return 0;
+}
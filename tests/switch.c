@@ -0,0 +1,77 @@
+int dense(int x) {
+    int r;
+    r = 0;
+    switch (x) {
+    case 0: r = 10; break;
+    case 1: r = 11;
+    case 2: r = r + 12; break;
+    default: r = -1; break;
+    case 3: r = 13; break;
+    case 4: r = 14;
+    case 5: r = r + 15;
+    case 6: r = r + 16; break;
+    case 7: r = 17; break;
+    }
+    return r;
+}
+
+int sparse(int x) {
+    switch (x) {
+    case -1000: return 1;
+    case -7: return 2;
+    case 0: return 3;
+    case 42: return 4;
+    case 99999: return 5;
+    default: return 0;
+    }
+}
+
+int digits(char *s) {
+    int n;
+    n = 0;
+    while (*s) {
+        switch (*s) {
+        case '0': case '1': case '2': case '3': case '4':
+        case '5': case '6': case '7': case '8': case '9':
+            ++n; break;
+        }
+        ++s;
+    }
+    return n;
+}
+
+int skip(int x) {
+    int i;
+    i = 0;
+    switch (x) {
+    case 1:
+        while (1) { if (i == 5) break; ++i; }
+        i = i * 10;
+        break;
+    default:
+        i = -1;
+    }
+    return i;
+}
+
+int main() {
+    int x;
+
+    x = -1;
+    while (x <= 8) { printf("dense(%d)  : %d\n", x, dense(x)); ++x; }
+    printf("\n");
+
+    printf("sparse(-1000) : %d\n", sparse(-1000));
+    printf("sparse(-7)    : %d\n", sparse(-7));
+    printf("sparse(0)     : %d\n", sparse(0));
+    printf("sparse(42)    : %d\n", sparse(42));
+    printf("sparse(99999) : %d\n", sparse(99999));
+    printf("sparse(43)    : %d\n", sparse(43));
+    printf("sparse(-8)    : %d\n", sparse(-8));
+    printf("\n");
+
+    printf("digits(\"a1b22c333\") : %d\n", digits("a1b22c333"));
+    printf("skip(1) : %d\n", skip(1));
+    printf("skip(2) : %d\n", skip(2));
+    return 0;
+}
@@ -0,0 +1,17 @@
+int count(int n, int acc) {
+    if (n == 0) return acc;
+    return count(n - 1, acc + 1);
+}
+
+int fib(int n, int a, int b) {
+    if (n == 0) return a;
+    return fib(n - 1, b, (a + b) % 1000007);
+}
+
+int main() {
+    printf("count(1000000, 0)  : %d\n", count(1000000, 0));
+    printf("count(3, 7)        : %d\n", count(3, 7));
+    printf("fib(1000000, 0, 1) : %d\n", fib(1000000, 0, 1));
+    printf("fib(10, 0, 1)      : %d\n", fib(10, 0, 1));
+    return 0;
+}
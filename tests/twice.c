@@ -0,0 +1,6 @@
+int calls;
+
+int twice(int x) {
+    ++calls;
+    return x + x;
+}